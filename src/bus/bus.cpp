@@ -1,5 +1,8 @@
 #include "bus.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #include "cdrom/cdrom.hpp"
 #include "cpu/cpu.hpp"
 #include "dma/dmacontroller.hpp"
@@ -13,10 +16,23 @@ namespace Bus {
 
 Bus::Bus(Cpu::Cpu& cpu, DMA::DMA& dma, Timers::Timers& timers, CDROM::CDROM& cdrom, SIO::SIO& sio, GPU::GPU& gpu, Spu::Spu& spu)
     : cpu(cpu), dma(dma), timers(timers), gpu(gpu), cdrom(cdrom), sio(sio), spu(spu) {
+#ifdef SHITSTATION_HOST_FASTMEM
+    // The page tables below point into the same memory, the interpreter keeps using them
+    if (hostMemory.create()) {
+        ram = hostMemory.ram();
+        bios = hostMemory.bios();
+        scratchpad = hostMemory.scratchpad();
+    } else {
+        Log::warn("[BUS] Host fastmem unavailable, falling back to the page tables\n");
+    }
+#endif
+
     try {
-        ram = new u8[MemorySize::Ram];
-        bios = new u8[MemorySize::Bios];
-        scratchpad = new u8[MemorySize::Scratchpad];
+        if (ram == nullptr) {
+            ram = new u8[MemorySize::Ram];
+            bios = new u8[MemorySize::Bios];
+            scratchpad = new u8[MemorySize::Scratchpad];
+        }
         readPages = new uintptr_t[MemorySize::FastMem];
         writePages = new uintptr_t[MemorySize::FastMem];
     } catch (...) {
@@ -48,12 +64,16 @@ Bus::Bus(Cpu::Cpu& cpu, DMA::DMA& dma, Timers::Timers& timers, CDROM::CDROM& cdr
         readPages[index + 0x9FC0] = pointer;  // KSEG0 BIOS
         readPages[index + 0xBFC0] = pointer;  // KSEG1 BIOS
     }
+
+    buildIoTables();
 }
 
 Bus::~Bus() {
-    delete[] ram;
-    delete[] bios;
-    delete[] scratchpad;
+    if (getFastmemBase() == nullptr) {
+        delete[] ram;
+        delete[] bios;
+        delete[] scratchpad;
+    }
     delete[] readPages;
     delete[] writePages;
 }
@@ -61,423 +81,422 @@ Bus::~Bus() {
 void Bus::reset() {
     std::memset(ram, 0, MemorySize::Ram);
     std::memset(scratchpad, 0, MemorySize::Scratchpad);
-    std::memset(MemControl, 0, sizeof(MemControl));
-    MemControl2 = 0;
+    // What the BIOS programs on boot, so code running before that still gets sensible timings
+    constexpr u32 memControlDefaults[9] = {
+        0x1F000000, 0x1F802000, 0x0013243F, 0x00003022, 0x0013243F, 0x200931E1, 0x00020843, 0x00070777, 0x00031125,
+    };
+    std::memcpy(MemControl, memControlDefaults, sizeof(MemControl));
+    MemControl2 = 0x00000B88;
+    updateWaitStates();
     CacheControl = 0;
     ISTAT = IMASK = 0;
+    cpu.updateInterrupts();
 }
 
 u32 Bus::fetch(u32 address) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = readPages[page];
+    const auto pointer = readPages[address >> 16];
 
-    if (page == 0xBFC0 || page == 0x9FC0 || page == 0x1FC0) {
-        cpu.addCycles(CycleBias::ROM);
-    }
+    cpu.addCycles(fetchCycles(address));
 
     // BIOS/RAM Fastmem Reads
     if (pointer != 0) {
-        return *(u32*)(pointer + offset);
+        return *(u32*)(pointer + (address & 0xFFFF));
     }
+
+    return readSlow<u32>(address);
 }
 
-u8 Bus::read8(u32 address) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = readPages[page];
+template <typename T>
+T Bus::read(u32 address) {
+    const auto pointer = readPages[address >> 16];
 
     if (cpu.isCacheIsolated()) return 0;
 
-    cpu.addCycles(CycleBias::RAM);
-
-    if (page == 0xBFC0 || page == 0x9FC0 || page == 0x1FC0) {
-        cpu.addCycles(CycleBias::ROM);
-    }
+    cpu.addCycles(waitStates[widthIndex<T>][physicalPage(address)]);
 
     // BIOS/RAM Fastmem Reads
     if (pointer != 0) {
-        return *(u8*)(pointer + offset);
-    }
-
-    // Slow Reads to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        return *(u8*)(scratchpad + offset);
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u8 scratchpad read from KSEG1 prohibited\n");
+        return *(T*)(pointer + (address & 0xFFFF));
     }
 
-    // Slow Reads to MMIO
-    auto hw_address = mask(address);
-
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.read<u8>(offset);
-    }
-
-    if (EXP2.contains(hw_address)) {
-        return 0xff;
-    }
-
-    if (EXP1.contains(hw_address)) {
-        return 0xff;
-    }
-
-    if (CDROM.contains(hw_address)) {
-        auto offset = CDROM.offset(hw_address);
-        return cdrom.read(offset);
-    }
-
-    Log::warn("[BUS] [READ8] Unhandled read at address: {:08x}\n", hw_address);
-    return 0;
+    return readSlow<T>(address);
 }
 
-u16 Bus::read16(u32 address) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = readPages[page];
+template <typename T>
+void Bus::write(u32 address, T value) {
+    const auto pointer = writePages[address >> 16];
 
-    if (cpu.isCacheIsolated()) return 0;
-
-    cpu.addCycles(CycleBias::RAM);
-
-    if (page == 0xBFC0 || page == 0x9FC0 || page == 0x1FC0) {
-        cpu.addCycles(CycleBias::ROM);
+    // Isolated cache writes are how the BIOS flushes the i-cache
+    if (cpu.isCacheIsolated()) {
+        cpu.invalidateCode(address);
+        return;
     }
 
-    // BIOS/RAM Fastmem Reads
-    if (pointer != 0) {
-        return *(u16*)(pointer + offset);
-    }
+    cpu.addCycles(waitStates[widthIndex<T>][physicalPage(address)]);
 
-    // Slow Reads to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        return *(u16*)(scratchpad + offset);
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u8 scratchpad read from KSEG1 prohibited\n");
+    // RAM Fastmem Writes
+    if (pointer != 0) {
+        const auto target = (T*)(pointer + (address & 0xFFFF));
+        if (journaling) [[unlikely]] {
+            journal.push_back({reinterpret_cast<u8*>(target), *target, sizeof(T)});
+        }
+        *target = value;
+        cpu.invalidateCode(address);
+        return;
     }
 
-    // Slow Reads to MMIO
-    auto hw_address = mask(address);
+    writeSlow<T>(address, value);
+}
 
-    // Temp timer2 stub
-    if (hw_address == 0x1f801120) {
-        return 0x000016b0;
+void Bus::rollbackJournal() {
+    for (auto record = journal.rbegin(); record != journal.rend(); ++record) {
+        std::memcpy(record->pointer, &record->value, record->size);
     }
+    journal.clear();
+}
 
-    if (IRQCONTROL.contains(hw_address)) {
-        auto offset = IRQCONTROL.offset(hw_address);
-        if (offset == 0) {
-            return ISTAT;
-        } else if (offset == 4) {
-            return IMASK;
-        }
-    }
+template u8 Bus::read<u8>(u32 address);
+template u16 Bus::read<u16>(u32 address);
+template u32 Bus::read<u32>(u32 address);
+template void Bus::write<u8>(u32 address, u8 value);
+template void Bus::write<u16>(u32 address, u16 value);
+template void Bus::write<u32>(u32 address, u32 value);
+
+namespace {
+// Access time of a device behind a delay/size register, per width. Follows the nocash formula: the first access pays the
+// read delay plus the COM0/COM2 delays it opted into, 8-bit devices split wider accesses into sequential byte accesses
+std::array<u32, 3> deviceTiming(u32 delaySize, u32 comDelay) {
+    const auto readDelay = static_cast<s32>((delaySize >> 4) & 0xF);
+    const auto com0 = static_cast<s32>(comDelay & 0xF);
+    const auto com2 = static_cast<s32>((comDelay >> 8) & 0xF);
+    const auto com3 = static_cast<s32>((comDelay >> 12) & 0xF);
+
+    s32 first = 0;
+    s32 sequential = 0;
+    s32 minimum = 0;
+    if (delaySize & (1 << 8)) {
+        first += com0 - 1;
+        sequential += com0 - 1;
+    }
+    if (delaySize & (1 << 10)) {
+        first += com2;
+        sequential += com2;
+    }
+    if (delaySize & (1 << 11)) {
+        minimum = com3;
+    }
+    if (first < 6) first++;
+
+    first += readDelay + 2;
+    sequential += readDelay + 2;
+    first = std::max(first, minimum + 6);
+    sequential = std::max(sequential, minimum + 2);
+
+    const bool wide = delaySize & (1 << 12);
+    const s32 half = wide ? first : first + sequential;
+    const s32 word = wide ? first + sequential : first + sequential * 3;
+    return {static_cast<u32>(first - 1), static_cast<u32>(half - 1), static_cast<u32>(word - 1)};
+}
+}  // namespace
 
-    if (CDROM.contains(hw_address)) {
-        auto offset = CDROM.offset(hw_address);
-        u8 value1 = cdrom.read(offset);
-        u8 value2 = cdrom.read(offset);
-        return (value1 << 8) | value2;
-    }
+void Bus::updateWaitStates() {
+    const u32 comDelay = MemControl[8];
 
-    if (SPU.contains(hw_address)) {
-        return spu.read16(hw_address);
+    for (auto& width : waitStates) {
+        width.fill(CycleBias::RAM);
     }
 
-    if (TIMERS.contains(hw_address)) {
-        auto offset = TIMERS.offset(hw_address);
-        //        return timers.read(offset);
-        return 0;
-    }
+    // Base register, delay/size register, in MemControl order. Expansion 3 has a fixed base
+    const auto mapRegion = [&](u32 address, u32 delaySize) {
+        const u32 base = address & 0x1FFFFFFF;
+        const auto timing = deviceTiming(delaySize, comDelay);
+        const u64 size = 1ull << ((delaySize >> 16) & 0x1F);
+        const u32 first = physicalPage(base);
+        const u32 last = static_cast<u32>(std::min<u64>((base + std::max<u64>(size, 64_KB) - 1) >> 16, PHYSICAL_PAGES - 1));
 
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.read<u16>(offset);
-    }
+        for (auto page = first; page <= last; page++) {
+            // RAM and the scratchpad/I/O page keep their own timing whatever the expansion base is set to
+            if (page < physicalPage(MemorySize::Ram * 4) || page == physicalPage(IO_BASE)) continue;
+            for (size_t width = 0; width < WIDTHS; width++) {
+                waitStates[width][page] = static_cast<u8>(std::min<u32>(timing[width], 0xFF));
+            }
+        }
+    };
+
+    mapRegion((MemControl[0] & 0x00FFFFFF) | 0x1F000000, MemControl[2]);  // Expansion 1
+    mapRegion(0x1FA00000, MemControl[3]);                                 // Expansion 3
+    mapRegion(BIOS.base, MemControl[4]);                                  // BIOS ROM
+
+    const auto setDevice = [&](IoDevice device, u32 delaySize) {
+        const auto timing = deviceTiming(delaySize, comDelay);
+        for (size_t width = 0; width < WIDTHS; width++) {
+            // The page entry already charged CycleBias::RAM
+            const u32 extra = timing[width] > CycleBias::RAM ? timing[width] - CycleBias::RAM : 0;
+            ioWaitStates[width][static_cast<size_t>(device)] = static_cast<u8>(std::min<u32>(extra, 0xFF));
+        }
+    };
 
-    // EXP1
-    Log::warn("[BUS] [READ16] Unhandled read at address: {:08x}\n", address);
-    return 0;
+    setDevice(IoDevice::Spu, MemControl[5]);
+    setDevice(IoDevice::Cdrom, MemControl[6]);
+    setDevice(IoDevice::Exp2, MemControl[7]);
 }
 
-u32 Bus::read32(u32 address) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = readPages[page];
-
-    if (cpu.isCacheIsolated()) return 0;
-
-    cpu.addCycles(CycleBias::RAM);
-
-    if (page == 0xBFC0 || page == 0x9FC0 || page == 0x1FC0) {
-        cpu.addCycles(CycleBias::ROM);
-    }
+void Bus::buildIoTables() {
+    for (auto device = 0; device < static_cast<int>(IoDevice::Count); device++) {
+        setIoHandlers<u8>(static_cast<IoDevice>(device), &readUnhandled<u8>, &writeUnhandled<u8>);
+        setIoHandlers<u16>(static_cast<IoDevice>(device), &readUnhandled<u16>, &writeUnhandled<u16>);
+        setIoHandlers<u32>(static_cast<IoDevice>(device), &readUnhandled<u32>, &writeUnhandled<u32>);
+    }
+
+    ioMap.fill(IoDevice::None);
+    mapIo(Range(IO_BASE, MemorySize::Scratchpad), IoDevice::Scratchpad);
+    mapIo(MEMCONTROL, IoDevice::MemControl);
+    mapIo(PAD, IoDevice::Pad);
+    mapIo(MEMCONTROL2, IoDevice::MemControl2);
+    mapIo(IRQCONTROL, IoDevice::IrqControl);
+    mapIo(DMA, IoDevice::Dma);
+    mapIo(TIMERS, IoDevice::Timers);
+    mapIo(CDROM, IoDevice::Cdrom);
+    mapIo(GPU, IoDevice::Gpu);
+    mapIo(SPU, IoDevice::Spu);
+    mapIo(EXP2, IoDevice::Exp2);
+
+    setIoHandlers<u8>(IoDevice::Scratchpad, &readScratchpad<u8>, &writeScratchpad<u8>);
+    setIoHandlers<u16>(IoDevice::Scratchpad, &readScratchpad<u16>, &writeScratchpad<u16>);
+    setIoHandlers<u32>(IoDevice::Scratchpad, &readScratchpad<u32>, &writeScratchpad<u32>);
+
+    setIoHandlers<u8>(IoDevice::Pad, &readPad<u8>, &writePad<u8>);
+    setIoHandlers<u16>(IoDevice::Pad, &readPad<u16>, &writePad<u16>);
+    setIoHandlers<u32>(IoDevice::Pad, &readPad<u32>, &writePad<u32>);
+
+    setIoHandlers<u16>(IoDevice::IrqControl, &readIrqControl<u16>, &writeIrqControl<u16>);
+    setIoHandlers<u32>(IoDevice::IrqControl, &readIrqControl<u32>, &writeIrqControl<u32>);
+
+    setIoHandlers<u16>(IoDevice::Timers, &readTimers<u16>, &writeTimers<u16>);
+    setIoHandlers<u32>(IoDevice::Timers, &readTimers<u32>, &writeTimers<u32>);
+
+    setIoHandlers<u8>(IoDevice::Spu, &readUnhandled<u8>, &writeSpu<u8>);
+    setIoHandlers<u16>(IoDevice::Spu, &readSpu<u16>, &writeSpu<u16>);
+    setIoHandlers<u32>(IoDevice::Spu, &readSpu<u32>, &writeSpu<u32>);
+
+    setIoHandlers<u8>(IoDevice::Dma, &readUnhandled<u8>, &writeDma<u8>);
+    setIoHandlers<u32>(IoDevice::Dma, &readDma, &writeDma<u32>);
+
+    setIoHandlers<u8>(IoDevice::Cdrom, &readCdrom8, &writeCdrom);
+    setIoHandlers<u16>(IoDevice::Cdrom, &readCdrom16, &writeUnhandled<u16>);
+
+    setIoHandlers<u32>(IoDevice::Gpu, &readGpu, &writeGpu);
+    setIoHandlers<u32>(IoDevice::MemControl, &readMemControl, &writeMemControl);
+    setIoHandlers<u32>(IoDevice::MemControl2, &readUnhandled<u32>, &writeMemControl2);
+    setIoHandlers<u8>(IoDevice::Exp2, &readExp2, &writeExp2);
+}
 
-    // BIOS/RAM Fastmem Reads
-    if (pointer != 0) {
-        return *(u32*)(pointer + offset);
+void Bus::mapIo(const Range& range, IoDevice device) {
+    for (auto address = range.base; address < range.base + range.size; address += 4) {
+        ioMap[(address - IO_BASE) >> 2] = device;
     }
+}
 
-    // Slow Reads to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        return *(u32*)(scratchpad + offset);
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u8 scratchpad read from KSEG1 prohibited\n");
-    }
+template <typename T>
+void Bus::setIoHandlers(IoDevice device, ReadHandler<T> reader, WriteHandler<T> writer) {
+    auto& handlers = ioHandlers<T>();
+    handlers.read[static_cast<size_t>(device)] = reader;
+    handlers.write[static_cast<size_t>(device)] = writer;
+}
 
-    // Slow Reads to MMIO
-    auto hw_address = mask(address);
+template <typename T>
+T Bus::readSlow(u32 address) {
+    const auto hw_address = mask(address);
+    slowAccesses++;
 
-    if (GPU.contains(hw_address)) {
-        auto offset = GPU.offset(hw_address);
-        if (offset == 0) {
-            return gpu.read0();
-        } else if (offset == 4) {
-            return gpu.read1();
+    if (hw_address - IO_BASE < IO_SIZE) {
+        const auto device = ioMap[(hw_address - IO_BASE) >> 2];
+        if (device == IoDevice::Scratchpad && address >= 0xA0000000) [[unlikely]] {
+            Helpers::panic("[BUS] u{} scratchpad read from KSEG1 prohibited\n", sizeof(T) * 8);
         }
-        return 0;
+        cpu.addCycles(ioWaitStates[widthIndex<T>][static_cast<size_t>(device)]);
+        return ioHandlers<T>().read[static_cast<size_t>(device)](*this, hw_address);
     }
 
-    if (IRQCONTROL.contains(hw_address)) {
-        auto offset = IRQCONTROL.offset(hw_address);
-        if (offset == 0) {
-            return ISTAT;
-        } else if (offset == 4) {
-            return IMASK;
+    if constexpr (!std::is_same_v<T, u16>) {
+        if (EXP1.contains(hw_address)) {
+            return 0xff;
         }
     }
 
-    if (DMA.contains(hw_address)) {
-        auto offset = DMA.offset(hw_address);
-        return dma.read(offset);
-    }
-
-    if (TIMERS.contains(hw_address)) {
-        auto offset = TIMERS.offset(hw_address);
-        return 0;
-    }
+    return readUnhandled<T>(*this, hw_address);
+}
 
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.read<u32>(offset);
-    }
+template <typename T>
+void Bus::writeSlow(u32 address, T value) {
+    const auto hw_address = mask(address);
+    slowAccesses++;
 
-    if (MEMCONTROL.contains(hw_address)) {
-        auto offset = MEMCONTROL.offset(hw_address);
-        return MemControl[offset >> 2];
+    if (hw_address - IO_BASE < IO_SIZE) {
+        const auto device = ioMap[(hw_address - IO_BASE) >> 2];
+        if (device == IoDevice::Scratchpad && address >= 0xA0000000) [[unlikely]] {
+            Helpers::panic("[BUS] u{} scratchpad write from KSEG1 prohibited\n", sizeof(T) * 8);
+        }
+        cpu.addCycles(ioWaitStates[widthIndex<T>][static_cast<size_t>(device)]);
+        return ioHandlers<T>().write[static_cast<size_t>(device)](*this, hw_address, value);
     }
 
-    if (SPU.contains(hw_address)) {
-        return spu.read32(hw_address);
+    if constexpr (std::is_same_v<T, u32>) {
+        if (CACHECONTROL.contains(hw_address)) {
+            CacheControl = value;
+            return;
+        }
     }
 
-    if (EXP1.contains(hw_address)) {
-        return 0xff;
-    }
+    writeUnhandled<T>(*this, hw_address, value);
+}
 
-    Log::warn("[BUS] [READ32] Unhandled read at address: {:08x}\n", address);
+template <typename T>
+T Bus::readUnhandled(Bus&, u32 address) {
+    Log::warn("[BUS] [READ{}] Unhandled read at address: {:08x}\n", sizeof(T) * 8, address);
     return 0;
 }
 
-void Bus::write8(u32 address, u8 value) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = writePages[page];
-
-    if (cpu.isCacheIsolated()) return;
-
-    cpu.addCycles(CycleBias::RAM);
-
-    // RAM Fastmem Writes
-    if (pointer != 0) {
-        *(u8*)(pointer + offset) = value;
-        return;
-    }
-
-    // Slow writes to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        *(u8*)(scratchpad + offset) = value;
-        return;
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u8 scratchpad write from KSEG1 prohibited\n");
-    }
-
-    // Slow writes to MMIO
-    auto hw_address = mask(address);
-
-    if (DMA.contains(hw_address)) {
-        auto offset = DMA.offset(hw_address);
-        return dma.write8(offset, value);
-    }
-
-    if (CDROM.contains(hw_address)) {
-        auto offset = CDROM.offset(hw_address);
-        cdrom.write(offset, value);
-        return;
-    }
-
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.write<u8>(offset, value);
-    }
-
-    if (SPU.contains(hw_address)) {
-        return spu.write8(hw_address, value);
-    }
-
-    if (EXP2.contains(hw_address)) {
-        return;
-    }
+template <typename T>
+void Bus::writeUnhandled(Bus&, u32 address, T value) {
+    Log::warn("[BUS] [WRITE{}] Unhandled write at address: {:08x} : value: {:08x}\n", sizeof(T) * 8, address, value);
+}
 
-    Log::warn("[BUS] [WRITE8] Unhandled write at address: {:08x} : value: {:08x}\n", address, value);
+template <typename T>
+T Bus::readScratchpad(Bus& bus, u32 address) {
+    return *(T*)(bus.scratchpad + (address - IO_BASE));
 }
 
-void Bus::write16(u32 address, u16 value) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = writePages[page];
+template <typename T>
+void Bus::writeScratchpad(Bus& bus, u32 address, T value) {
+    *(T*)(bus.scratchpad + (address - IO_BASE)) = value;
+}
 
-    if (cpu.isCacheIsolated()) return;
+template <typename T>
+T Bus::readPad(Bus& bus, u32 address) {
+    return bus.sio.read<T>(bus.PAD.offset(address));
+}
 
-    cpu.addCycles(CycleBias::RAM);
+template <typename T>
+void Bus::writePad(Bus& bus, u32 address, T value) {
+    bus.sio.write<T>(bus.PAD.offset(address), value);
+}
 
-    // RAM Fastmem Writes
-    if (pointer != 0) {
-        *(u16*)(pointer + offset) = value;
-        return;
+template <typename T>
+T Bus::readIrqControl(Bus& bus, u32 address) {
+    auto offset = bus.IRQCONTROL.offset(address);
+    if (offset == 0) {
+        return bus.ISTAT;
+    } else if (offset == 4) {
+        return bus.IMASK;
     }
+    return readUnhandled<T>(bus, address);
+}
 
-    // Slow writes to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        *(u16*)(scratchpad + offset) = value;
-        return;
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u16 scratchpad write from KSEG1 prohibited\n");
+template <typename T>
+void Bus::writeIrqControl(Bus& bus, u32 address, T value) {
+    auto offset = bus.IRQCONTROL.offset(address);
+    if (offset == 0) {
+        bus.ISTAT &= (value & 0x7FF);
+    } else if (offset == 4) {
+        bus.IMASK = (value & 0x7FF);
     }
+    bus.cpu.updateInterrupts();
+}
 
-    // Slow writes to MMIO
-    auto hw_address = mask(address);
-
-    if (IRQCONTROL.contains(hw_address)) {
-        auto offset = IRQCONTROL.offset(hw_address);
-        if (offset == 0) {
-            ISTAT &= (value & 0x7FF);
-        } else if (offset == 4) {
-            IMASK = (value & 0x7FF);
-        }
-        return;
-    }
+template <typename T>
+T Bus::readTimers(Bus& bus, u32 address) {
+    return bus.timers.read(bus.TIMERS.offset(address));
+}
 
-    if (SPU.contains(hw_address)) {
-        return spu.write16(hw_address, value);
-    }
+template <typename T>
+void Bus::writeTimers(Bus& bus, u32 address, T value) {
+    bus.timers.write(bus.TIMERS.offset(address), static_cast<u16>(value));
+}
 
-    if (TIMERS.contains(hw_address)) {
-        auto offset = TIMERS.offset(hw_address);
-        timers.write(offset, value);
-        return;
-    }
+template <typename T>
+T Bus::readSpu(Bus& bus, u32 address) {
+    if constexpr (std::is_same_v<T, u32>)
+        return bus.spu.read32(address);
+    else
+        return bus.spu.read16(address);
+}
 
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.write<u16>(offset, value);
+template <typename T>
+void Bus::writeSpu(Bus& bus, u32 address, T value) {
+    if constexpr (std::is_same_v<T, u32>) {
+        bus.spu.write16(address, value & 0xFFFF);
+        bus.spu.write16(address, static_cast<u16>(value >> 16));
+    } else if constexpr (std::is_same_v<T, u16>) {
+        bus.spu.write16(address, value);
+    } else {
+        bus.spu.write8(address, value);
     }
-    // SPU
-    Log::warn("[BUS] [WRITE16] Unhandled write at address: {:08x} : value: {:08x}\n", address, value);
 }
 
-void Bus::write32(u32 address, u32 value) {
-    const auto page = address >> 16;
-    const auto offset = address & 0xFFFF;
-    const auto pointer = writePages[page];
-
-    if (cpu.isCacheIsolated()) return;
-
-    cpu.addCycles(CycleBias::RAM);
-
-    // RAM Fastmem Writes
-    if (pointer != 0) {
-        *(u32*)(pointer + offset) = value;
-        return;
-    }
+template <typename T>
+void Bus::writeDma(Bus& bus, u32 address, T value) {
+    if constexpr (std::is_same_v<T, u32>)
+        bus.dma.write(bus.DMA.offset(address), value);
+    else
+        bus.dma.write8(bus.DMA.offset(address), value);
+}
 
-    // Slow writes to Scratchpad
-    if ((page == 0x1F80 || page == 0x9F80) && offset < MemorySize::Scratchpad) {
-        *(u32*)(scratchpad + offset) = value;
-        return;
-    } else if (page == 0xBF80 && offset < MemorySize::Scratchpad) {
-        Helpers::panic("[BUS] u32 scratchpad write from KSEG1 prohibited\n");
-    }
+u32 Bus::readDma(Bus& bus, u32 address) { return bus.dma.read(bus.DMA.offset(address)); }
 
-    // Slow writes to MMIO
-    auto hw_address = mask(address);
+u8 Bus::readCdrom8(Bus& bus, u32 address) { return bus.cdrom.read(bus.CDROM.offset(address)); }
 
-    if (IRQCONTROL.contains(hw_address)) {
-        auto offset = IRQCONTROL.offset(hw_address);
-        if (offset == 0) {
-            ISTAT &= (value & 0x7FF);
-        } else if (offset == 4) {
-            IMASK = (value & 0x7FF);
-        }
-        return;
-    }
+u16 Bus::readCdrom16(Bus& bus, u32 address) {
+    auto offset = bus.CDROM.offset(address);
+    u8 value1 = bus.cdrom.read(offset);
+    u8 value2 = bus.cdrom.read(offset);
+    return (value1 << 8) | value2;
+}
 
-    if (MEMCONTROL.contains(hw_address)) {
-        auto offset = MEMCONTROL.offset(hw_address);
-        MemControl[offset >> 2] = value;
-        return;
-    }
+void Bus::writeCdrom(Bus& bus, u32 address, u8 value) { bus.cdrom.write(bus.CDROM.offset(address), value); }
 
-    if (MEMCONTROL2.contains(hw_address)) {
-        MemControl2 = value;
-        return;
+u32 Bus::readGpu(Bus& bus, u32 address) {
+    auto offset = bus.GPU.offset(address);
+    if (offset == 0) {
+        return bus.gpu.read0();
+    } else if (offset == 4) {
+        return bus.gpu.read1();
     }
+    return 0;
+}
 
-    if (CACHECONTROL.contains(hw_address)) {
-        CacheControl = value;
-        return;
+void Bus::writeGpu(Bus& bus, u32 address, u32 value) {
+    auto offset = bus.GPU.offset(address);
+    if (offset == 0) {
+        bus.gpu.write0(value);
+    } else if (offset == 4) {
+        bus.gpu.write1(value);
     }
+}
 
-    if (DMA.contains(hw_address)) {
-        auto offset = DMA.offset(hw_address);
-        return dma.write(offset, value);
-    }
+u32 Bus::readMemControl(Bus& bus, u32 address) { return bus.MemControl[bus.MEMCONTROL.offset(address) >> 2]; }
 
-    if (TIMERS.contains(hw_address)) {
-        auto offset = TIMERS.offset(hw_address);
-        timers.write(offset, value);
-        return;
-    }
+void Bus::writeMemControl(Bus& bus, u32 address, u32 value) {
+    bus.MemControl[bus.MEMCONTROL.offset(address) >> 2] = value;
 
-    if (PAD.contains(hw_address)) {
-        auto offset = PAD.offset(hw_address);
-        return sio.write<u32>(offset, value);
+    // Blocks carry their fetch timing, drop them if it changed
+    const auto fetchTiming = bus.waitStates[WORD];
+    bus.updateWaitStates();
+    if (bus.waitStates[WORD] != fetchTiming) {
+        bus.cpu.invalidateBlocks();
     }
+}
 
-    if (GPU.contains(hw_address)) {
-        auto offset = GPU.offset(hw_address);
-        if (offset == 0) {
-            gpu.write0(value);
-        } else if (offset == 4) {
-            gpu.write1(value);
-        }
-        return;
-    }
+void Bus::writeMemControl2(Bus& bus, u32, u32 value) { bus.MemControl2 = value; }
 
-    if (SPU.contains(hw_address)) {
-        spu.write16(hw_address, value & 0xFFFF);
-        spu.write16(hw_address, value >> 16);
-    }
+// Includes PCSX-Redux expansion registers, which are ignored
+u8 Bus::readExp2(Bus&, u32) { return 0xff; }
 
-    // SPU
-    // GPU
-    Log::warn("[BUS] [WRITE32] Unhandled write at address: {:08x} : value: {:08x}\n", address, value);
-}
+void Bus::writeExp2(Bus&, u32, u8) {}
 
 void Bus::triggerInterrupt(IRQ irq) {
     ISTAT |= (1 << static_cast<u16>(irq));
-    cpu.triggerInterrupt();
+    cpu.updateInterrupts();
 }
 
 void Bus::doSideload() {
@@ -487,6 +506,7 @@ void Bus::doSideload() {
     cpu.setPC(sideloadPC);
 
     std::memcpy(ram + addr, sideloadEXE.data(), size);
+    cpu.clearBlockCache();
 }
 
 }  // namespace Bus
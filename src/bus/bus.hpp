@@ -1,11 +1,16 @@
 #pragma once
+#include <array>
 #include <cassert>
 #include <vector>
 
 #include "support/helpers.hpp"
 
+#ifdef SHITSTATION_HOST_FASTMEM
+#include "bus/hostmemory.hpp"
+#endif
+
 // clang-format off
-namespace Cpu { class Cpu; }
+namespace Cpu { class Cpu; class Recompiler; }
 namespace DMA { class DMA; }
 namespace Timers { class Timers; }
 namespace GPU { class GPU; }
@@ -34,7 +39,6 @@ enum : u32 { Bios = 512_KB, Ram = 2_MB, Scratchpad = 1_KB, FastMem = 64_KB };
 
 namespace CycleBias {
 enum : u32 {
-    ROM = 20,
     RAM = 1,
     CPI = 2,
 };
@@ -47,39 +51,36 @@ class Bus {
 
     void reset();
 
-    u8 read8(u32 address);
-    u16 read16(u32 address);
-    u32 read32(u32 address);
-
-    void write8(u32 address, u8 value);
-    void write16(u32 address, u16 value);
-    void write32(u32 address, u32 value);
+    // Instantiated for u8, u16 and u32
+    template <typename T>
+    T read(u32 address);
+    template <typename T>
+    void write(u32 address, T value);
 
     [[nodiscard]] bool isIRQPending() const { return (ISTAT & IMASK) != 0; }
     void triggerInterrupt(IRQ irq);
 
     u32 fetch(u32 address);
 
-    template <typename T>
-    T read(u32 address) {
-        if constexpr (std::is_same_v<T, u32>)
-            return read32(address);
-        else if constexpr (std::is_same_v<T, u16>)
-            return read16(address);
-        else if constexpr (std::is_same_v<T, u8>)
-            return read8(address);
+    // Instruction memory lookup for the block compiler, no timing side effects
+    [[nodiscard]] const u32* getFetchPointer(u32 address) const {
+        const auto pointer = readPages[address >> 16];
+        if (pointer == 0) return nullptr;
+        return (const u32*)(pointer + (address & 0xFFFF));
     }
 
-    template <typename T>
-    void write(u32 address, T value) {
-        if constexpr (std::is_same_v<T, u32>)
-            write32(address, value);
-        else if constexpr (std::is_same_v<T, u16>)
-            write16(address, value);
-        else if constexpr (std::is_same_v<T, u8>)
-            write8(address, value);
+    // Host address of guest address 0 in the host fastmem window, nullptr when guest memory lives in the page tables only
+    [[nodiscard]] u8* getFastmemBase() const {
+#ifdef SHITSTATION_HOST_FASTMEM
+        return hostMemory.base();
+#else
+        return nullptr;
+#endif
     }
 
+    // Extra cycles an instruction fetch from `address` stalls for on top of CycleBias::CPI
+    [[nodiscard]] u32 fetchCycles(u32 address) const { return waitStates[WORD][physicalPage(address)] - CycleBias::RAM; }
+
     template <typename T = u8>
     T* getRamPointer(u32 address = 0) {
         auto addr = mask(address);
@@ -107,8 +108,19 @@ class Bus {
 
     void doSideload();
 
+    // Lockstep support for the CPU. While journaling, RAM writes remember the bytes they replace so rollbackJournal() can
+    // put them back. Accesses that leave RAM and BIOS reach devices and cannot be undone, they are only counted
+    void beginJournal() {
+        journal.clear();
+        journaling = true;
+    }
+    void endJournal() { journaling = false; }
+    void rollbackJournal();
+    [[nodiscard]] u64 getSlowAccesses() const { return slowAccesses; }
+
   private:
     friend class DMA::DMA;
+    friend class Cpu::Recompiler;
 
     Cpu::Cpu& cpu;
     DMA::DMA& dma;
@@ -121,6 +133,19 @@ class Bus {
     u32 CacheControl;
     u32 MemControl[9];
     u32 MemControl2;
+
+    // Cycles an access of each width costs per physical 64KB page, derived from the MemControl delay/size registers and
+    // only rebuilt when those are written. Page 0x1F80 mixes scratchpad and I/O ports, devices with their own delay
+    // register add the difference on the slow path
+    enum : size_t { BYTE, HALF, WORD, WIDTHS };
+    static constexpr size_t PHYSICAL_PAGES = 0x2000;
+
+    template <typename T>
+    static constexpr size_t widthIndex = sizeof(T) == 4 ? WORD : sizeof(T) - 1;
+    static u32 physicalPage(u32 address) { return (address >> 16) & (PHYSICAL_PAGES - 1); }
+
+    std::array<std::array<u8, PHYSICAL_PAGES>, WIDTHS> waitStates{};
+    void updateWaitStates();
     u16 ISTAT;
     u16 IMASK;
 
@@ -131,6 +156,19 @@ class Bus {
     uintptr_t* readPages = nullptr;
     uintptr_t* writePages = nullptr;
 
+#ifdef SHITSTATION_HOST_FASTMEM
+    HostMemory hostMemory;
+#endif
+
+    struct WriteRecord {
+        u8* pointer;
+        u32 value;
+        u32 size;
+    };
+    std::vector<WriteRecord> journal;
+    bool journaling = false;
+    u64 slowAccesses = 0;
+
     u32 sideloadPC;
     u32 sideloadAddr;
     std::vector<u8> sideloadEXE;
@@ -152,6 +190,90 @@ class Bus {
     const Range EXP1 = {0x1F000000, 0x800000};
     const Range EXP2 = {0x1F802000, 0x88};  // Includes PCSX-Redux expansion registers
 
+    // The scratchpad and the I/O ports share one 64KB page, so fastmem cannot map either of them. Accesses to that area look up
+    // the device behind their 4-byte slot, then the handler that device has for the access width
+    enum class IoDevice : u8 { None, Scratchpad, MemControl, Pad, MemControl2, IrqControl, Dma, Timers, Cdrom, Gpu, Spu, Exp2, Count };
+
+    static constexpr u32 IO_BASE = 0x1F800000;
+    static constexpr u32 IO_SIZE = 0x3000;
+
+    template <typename T>
+    using ReadHandler = T (*)(Bus&, u32);
+    template <typename T>
+    using WriteHandler = void (*)(Bus&, u32, T);
+
+    template <typename T>
+    struct IoHandlers {
+        std::array<ReadHandler<T>, static_cast<size_t>(IoDevice::Count)> read;
+        std::array<WriteHandler<T>, static_cast<size_t>(IoDevice::Count)> write;
+    };
+
+    std::array<IoDevice, IO_SIZE / 4> ioMap{};
+    std::array<std::array<u8, static_cast<size_t>(IoDevice::Count)>, WIDTHS> ioWaitStates{};
+    IoHandlers<u8> io8;
+    IoHandlers<u16> io16;
+    IoHandlers<u32> io32;
+
+    template <typename T>
+    IoHandlers<T>& ioHandlers() {
+        if constexpr (std::is_same_v<T, u32>)
+            return io32;
+        else if constexpr (std::is_same_v<T, u16>)
+            return io16;
+        else
+            return io8;
+    }
+
+    void buildIoTables();
+    void mapIo(const Range& range, IoDevice device);
+    template <typename T>
+    void setIoHandlers(IoDevice device, ReadHandler<T> read, WriteHandler<T> write);
+
+    // Everything fastmem does not cover: scratchpad, I/O ports, the expansion regions and cache control
+    template <typename T>
+    T readSlow(u32 address);
+    template <typename T>
+    void writeSlow(u32 address, T value);
+
+    // Per device handlers, `address` is the physical address
+    template <typename T>
+    static T readUnhandled(Bus& bus, u32 address);
+    template <typename T>
+    static void writeUnhandled(Bus& bus, u32 address, T value);
+    template <typename T>
+    static T readScratchpad(Bus& bus, u32 address);
+    template <typename T>
+    static void writeScratchpad(Bus& bus, u32 address, T value);
+    template <typename T>
+    static T readPad(Bus& bus, u32 address);
+    template <typename T>
+    static void writePad(Bus& bus, u32 address, T value);
+    template <typename T>
+    static T readIrqControl(Bus& bus, u32 address);
+    template <typename T>
+    static void writeIrqControl(Bus& bus, u32 address, T value);
+    template <typename T>
+    static T readTimers(Bus& bus, u32 address);
+    template <typename T>
+    static void writeTimers(Bus& bus, u32 address, T value);
+    template <typename T>
+    static T readSpu(Bus& bus, u32 address);
+    template <typename T>
+    static void writeSpu(Bus& bus, u32 address, T value);
+    template <typename T>
+    static void writeDma(Bus& bus, u32 address, T value);
+    static u32 readDma(Bus& bus, u32 address);
+    static u8 readCdrom8(Bus& bus, u32 address);
+    static u16 readCdrom16(Bus& bus, u32 address);
+    static void writeCdrom(Bus& bus, u32 address, u8 value);
+    static u32 readGpu(Bus& bus, u32 address);
+    static void writeGpu(Bus& bus, u32 address, u32 value);
+    static u32 readMemControl(Bus& bus, u32 address);
+    static void writeMemControl(Bus& bus, u32 address, u32 value);
+    static void writeMemControl2(Bus& bus, u32 address, u32 value);
+    static u8 readExp2(Bus& bus, u32 address);
+    static void writeExp2(Bus& bus, u32 address, u8 value);
+
     const u32 region_mask[8] = {
         0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0x7fffffff, 0x1fffffff, 0xffffffff, 0xffffffff,
     };
@@ -0,0 +1,235 @@
+#include "hostmemory.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "support/log.hpp"
+
+namespace Bus {
+
+namespace {
+// Guest segment bases with RAM behind them
+constexpr u32 RAM_SEGMENTS[] = {0x00000000, 0x80000000, 0xA0000000};
+constexpr u32 BIOS_ADDRESSES[] = {0x1FC00000, 0x9FC00000, 0xBFC00000};
+constexpr size_t RAM_SIZE = 2_MB;
+constexpr size_t RAM_MIRRORS = 4;
+constexpr size_t BIOS_SIZE = 512_KB;
+
+// One registration per live window. The handler runs on whichever thread faulted and only ever reads these, the window is
+// published last and retracted first so it never sees a half filled entry
+struct Registration {
+    std::atomic<u8*> window = nullptr;
+    std::atomic<HostMemory::FaultCallback> callback = nullptr;
+    std::atomic<void*> context = nullptr;
+};
+std::array<Registration, HostMemory::MAX_WINDOWS> registrations;
+
+// Guards the registry slots and the handler install count, never taken inside the handler
+std::mutex registryMutex;
+size_t windowCount = 0;
+
+struct sigaction previousSegv {};
+struct sigaction previousBus {};
+
+bool programCounter(void* raw, uintptr_t*& pc) {
+#if defined(__x86_64__) && defined(__linux__)
+    pc = reinterpret_cast<uintptr_t*>(&static_cast<ucontext_t*>(raw)->uc_mcontext.gregs[REG_RIP]);
+    return true;
+#elif defined(__x86_64__) && defined(__APPLE__)
+    pc = reinterpret_cast<uintptr_t*>(&static_cast<ucontext_t*>(raw)->uc_mcontext->__ss.__rip);
+    return true;
+#elif defined(__x86_64__) && defined(__FreeBSD__)
+    pc = reinterpret_cast<uintptr_t*>(&static_cast<ucontext_t*>(raw)->uc_mcontext.mc_rip);
+    return true;
+#else
+    (void)raw;
+    pc = nullptr;
+    return false;
+#endif
+}
+
+void handleFault(int signal, siginfo_t* info, void* raw);
+
+bool resumeFault(siginfo_t* info, void* raw) {
+    const auto address = static_cast<u8*>(info->si_addr);
+    for (const auto& registration : registrations) {
+        const auto window = registration.window.load(std::memory_order_acquire);
+        if (window == nullptr || address < window || address >= window + HostMemory::WINDOW_SIZE) continue;
+
+        const auto callback = registration.callback.load(std::memory_order_acquire);
+        uintptr_t* pc;
+        uintptr_t resume;
+        if (callback == nullptr || !programCounter(raw, pc)) return false;
+        if (!callback(registration.context.load(std::memory_order_acquire), *pc, resume)) return false;
+        *pc = resume;
+        return true;
+    }
+    return false;
+}
+
+void handleFault(int signal, siginfo_t* info, void* raw) {
+    if (resumeFault(info, raw)) return;
+
+    // Not ours, chain to whatever was installed before, or let the fault kill us the usual way. Never chain back into this
+    // handler, the fault would just come around again
+    const auto& previous = signal == SIGBUS ? previousBus : previousSegv;
+    if ((previous.sa_flags & SA_SIGINFO) && previous.sa_sigaction != handleFault) {
+        previous.sa_sigaction(signal, info, raw);
+    } else if ((previous.sa_flags & SA_SIGINFO) || previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+        struct sigaction fallback {};
+        fallback.sa_handler = SIG_DFL;
+        sigemptyset(&fallback.sa_mask);
+        sigaction(signal, (previous.sa_flags & SA_SIGINFO) ? &fallback : &previous, nullptr);
+    } else {
+        previous.sa_handler(signal);
+    }
+}
+
+// Both called with registryMutex held, the handler stays installed while any window exists
+void installHandler() {
+    if (windowCount++ != 0) return;
+
+    struct sigaction action {};
+    action.sa_sigaction = handleFault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousSegv);
+    // macOS raises SIGBUS for accesses to reserved but inaccessible pages
+    sigaction(SIGBUS, &action, &previousBus);
+}
+
+void restoreHandler() {
+    if (--windowCount != 0) return;
+
+    sigaction(SIGSEGV, &previousSegv, nullptr);
+    sigaction(SIGBUS, &previousBus, nullptr);
+}
+
+int createSharedMemory(size_t size) {
+#if defined(__linux__)
+    int fd = memfd_create("shitstation", 0);
+#else
+    const auto name = "/shitstation." + std::to_string(getpid());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) shm_unlink(name.c_str());
+#endif
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+}  // namespace
+
+HostMemory::~HostMemory() { destroy(); }
+
+bool HostMemory::create() {
+    {
+        std::lock_guard lock(registryMutex);
+        for (size_t index = 0; index < registrations.size(); index++) {
+            // Claimed slots hold a placeholder until the window is mapped, the handler never matches it
+            u8* expected = nullptr;
+            if (registrations[index].window.compare_exchange_strong(expected, reinterpret_cast<u8*>(UINTPTR_MAX))) {
+                slot = static_cast<int>(index);
+                break;
+            }
+        }
+    }
+    if (slot < 0) {
+        Log::warn("[BUS] Too many fastmem windows in this process\n");
+        return false;
+    }
+
+    fd = createSharedMemory(BACKING_SIZE);
+    if (fd < 0) {
+        Log::warn("[BUS] Failed to create the guest memory object\n");
+        destroy();
+        return false;
+    }
+
+    void* pointer = mmap(nullptr, BACKING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pointer == MAP_FAILED) {
+        Log::warn("[BUS] Failed to map the guest memory object\n");
+        destroy();
+        return false;
+    }
+    backing = static_cast<u8*>(pointer);
+
+    pointer = mmap(nullptr, WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pointer == MAP_FAILED) {
+        Log::warn("[BUS] Failed to reserve the 4 GiB fastmem window\n");
+        destroy();
+        return false;
+    }
+    window = static_cast<u8*>(pointer);
+
+    bool mapped = true;
+    for (const auto segment : RAM_SEGMENTS) {
+        for (size_t mirror = 0; mirror < RAM_MIRRORS; mirror++) {
+            mapped &= map(segment + static_cast<u32>(mirror * RAM_SIZE), RAM_OFFSET, RAM_SIZE, true);
+        }
+    }
+    for (const auto address : BIOS_ADDRESSES) {
+        mapped &= map(address, BIOS_OFFSET, BIOS_SIZE, false);
+    }
+    // The scratchpad stays unmapped, the smallest host page would also back the 3KB of open bus above it
+
+    if (!mapped) {
+        Log::warn("[BUS] Failed to map guest memory into the fastmem window\n");
+        destroy();
+        return false;
+    }
+
+    std::lock_guard lock(registryMutex);
+    installHandler();
+    registrations[static_cast<size_t>(slot)].window.store(window, std::memory_order_release);
+    return true;
+}
+
+void HostMemory::setFaultCallback(FaultCallback callback, void* context) {
+    if (slot < 0) return;
+    auto& registration = registrations[static_cast<size_t>(slot)];
+    registration.callback.store(nullptr, std::memory_order_release);
+    registration.context.store(context, std::memory_order_release);
+    registration.callback.store(callback, std::memory_order_release);
+}
+
+bool HostMemory::map(u32 address, size_t offset, size_t size, bool writable) {
+    const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void* view = mmap(window + address, size, protection, MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(offset));
+    return view != MAP_FAILED;
+}
+
+void HostMemory::destroy() {
+    if (slot >= 0) {
+        std::lock_guard lock(registryMutex);
+        auto& registration = registrations[static_cast<size_t>(slot)];
+        const bool installed = registration.window.load() == window && window != nullptr;
+        registration.callback.store(nullptr, std::memory_order_release);
+        registration.context.store(nullptr, std::memory_order_release);
+        registration.window.store(nullptr, std::memory_order_release);
+        if (installed) restoreHandler();
+        slot = -1;
+    }
+    if (window != nullptr) {
+        munmap(window, WINDOW_SIZE);
+        window = nullptr;
+    }
+    if (backing != nullptr) {
+        munmap(backing, BACKING_SIZE);
+        backing = nullptr;
+    }
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+}  // namespace Bus
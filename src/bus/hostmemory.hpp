@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "support/helpers.hpp"
+
+namespace Bus {
+
+// Guest RAM, BIOS and scratchpad backed by one shared memory object, with RAM and BIOS mapped into a reserved 4 GiB host
+// window so a guest address is a plain offset from base(). Mirrors are aliased views of the same pages, the BIOS views are
+// read only and everything else, MMIO and the 1KB scratchpad included, stays unmapped. Accesses that fault inside the window are handed to that window's
+// fault callback, which may resume the faulting thread elsewhere. Several instances can coexist, up to MAX_WINDOWS,
+// sharing one signal handler. POSIX only.
+class HostMemory {
+  public:
+    // Returns true and sets `resume` when the faulting host instruction at `pc` has a slow path to continue at
+    using FaultCallback = bool (*)(void* context, uintptr_t pc, uintptr_t& resume);
+
+    static constexpr size_t WINDOW_SIZE = 0x100000000ULL;
+    static constexpr size_t MAX_WINDOWS = 16;
+
+    HostMemory() = default;
+    ~HostMemory();
+
+    HostMemory(const HostMemory&) = delete;
+    HostMemory& operator=(const HostMemory&) = delete;
+
+    // Reserves the window and maps the views, returns false and leaves nothing mapped if the host refuses or MAX_WINDOWS
+    // windows already exist
+    bool create();
+
+    [[nodiscard]] u8* base() const { return window; }
+    [[nodiscard]] u8* ram() const { return backing + RAM_OFFSET; }
+    [[nodiscard]] u8* bios() const { return backing + BIOS_OFFSET; }
+    [[nodiscard]] u8* scratchpad() const { return backing + SCRATCHPAD_OFFSET; }
+
+    // Pass nullptr to stop resuming faults in this window
+    void setFaultCallback(FaultCallback callback, void* context);
+
+  private:
+    // Offsets into the shared memory object, each aligned to the largest host page size we expect
+    static constexpr size_t RAM_OFFSET = 0;
+    static constexpr size_t BIOS_OFFSET = 2_MB;
+    static constexpr size_t SCRATCHPAD_OFFSET = 2_MB + 512_KB;
+    static constexpr size_t BACKING_SIZE = SCRATCHPAD_OFFSET + 64_KB;
+
+    int fd = -1;
+    int slot = -1;  // Index in the fault handler's window registry
+    u8* backing = nullptr;
+    u8* window = nullptr;
+
+    bool map(u32 address, size_t offset, size_t size, bool writable);
+    void destroy();
+};
+
+}  // namespace Bus
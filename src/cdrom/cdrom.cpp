@@ -8,7 +8,14 @@
 
 namespace CDROM {
 
-CDROM::CDROM(Scheduler::Scheduler& scheduler) : scheduler(scheduler) { reset(); }
+CDROM::CDROM(Scheduler::Scheduler& scheduler) : scheduler(scheduler) {
+    using enum Scheduler::Event;
+    scheduler.registerEvent(CDROMInterrupt, [this]() { deliverInterrupt(); });
+    scheduler.registerEvent(CDROMRead, [this]() { readSector(); });
+    scheduler.registerEvent(CDROMCommandStart, [this]() { tryStartCommand(); });
+    scheduler.registerEvent(CDROMCommandFinish, [this]() { tryFinishCommand(); });
+    reset();
+}
 
 void CDROM::loadDisc(const std::filesystem::path& path) { m_disc.loadDisc(path); }
 
@@ -21,6 +28,12 @@ void CDROM::reset() {
     m_pendingCommand = Commands::None;
     m_sector.resize(2352);
     m_dataFifoIndex = 0;
+    m_ints = {};
+    m_intDeadlineCount = 0;
+    scheduler.cancel(Scheduler::Event::CDROMInterrupt);
+    scheduler.cancel(Scheduler::Event::CDROMCommandStart);
+    scheduler.cancel(Scheduler::Event::CDROMCommandFinish);
+    stopReading();
     m_disc.reset();
 }
 
@@ -33,21 +46,34 @@ void CDROM::newCommand(u8 value) {
 }
 
 void CDROM::scheduleInterrupt(u32 cycles) {
-    scheduler.scheduleEvent(cycles, [&]() {
-        m_irqFlags |= m_ints.front();
-        scheduler.bus.triggerInterrupt(Bus::IRQ::CDROM);
-        m_ints.pop();
-    });
-}
+    if (m_intDeadlineCount == MAX_PENDING_INTERRUPTS) {
+        Helpers::panic("[CDROM] Too many pending interrupts\n");
+    }
 
-void CDROM::scheduleCommandFinish(u32 cycles) {
-    scheduler.scheduleEvent(cycles, [this]() { tryFinishCommand(); });
+    const auto deadline = scheduler.cycles() + cycles;
+    auto i = m_intDeadlineCount++;
+    for (; i > 0 && m_intDeadlines[i - 1] > deadline; i--) {
+        m_intDeadlines[i] = m_intDeadlines[i - 1];
+    }
+    m_intDeadlines[i] = deadline;
+    scheduler.scheduleAt(Scheduler::Event::CDROMInterrupt, m_intDeadlines[0]);
 }
 
-void CDROM::scheduleStartCommand(u32 cycles) {
-    scheduler.scheduleEvent(cycles, [this]() { tryStartCommand(); });
+void CDROM::deliverInterrupt() {
+    m_irqFlags |= m_ints.front();
+    scheduler.bus.triggerInterrupt(Bus::IRQ::CDROM);
+    m_ints.pop();
+
+    std::copy(m_intDeadlines.begin() + 1, m_intDeadlines.begin() + m_intDeadlineCount, m_intDeadlines.begin());
+    if (--m_intDeadlineCount != 0) {
+        scheduler.scheduleAt(Scheduler::Event::CDROMInterrupt, m_intDeadlines[0]);
+    }
 }
 
+void CDROM::scheduleCommandFinish(u32 cycles) { scheduler.schedule(Scheduler::Event::CDROMCommandFinish, cycles); }
+
+void CDROM::scheduleStartCommand(u32 cycles) { scheduler.schedule(Scheduler::Event::CDROMCommandStart, cycles); }
+
 void CDROM::scheduleRead() {
     u32 speed = m_mode.Speed ? 150 : 75;
     u32 cycles = 33868800 / speed;
@@ -55,11 +81,10 @@ void CDROM::scheduleRead() {
         cycles = 33868800 * 3;
         m_delayFirstRead = false;
     }
-    scheduler.scheduleEvent(cycles, [this]() { readSector(); });
+    m_readEvent = scheduler.schedule(Scheduler::Event::CDROMRead, cycles);
 }
 
 void CDROM::readSector() {
-    if (m_state != State::Read) return;
     m_disc.read();
     m_responseFifo.push(m_statusCode.r);
     m_ints.emplace(InterruptCause::INT1);
@@ -67,6 +92,11 @@ void CDROM::readSector() {
     scheduleRead();
 }
 
+void CDROM::stopReading() {
+    m_state = State::Idle;
+    scheduler.cancel(m_readEvent);
+}
+
 void CDROM::tryStartCommand() {
     using enum Commands;
 
@@ -82,6 +112,7 @@ void CDROM::tryStartCommand() {
     // Log::debug("[CDROM] Starting Command: {}\n", magic_enum::enum_name(m_command));
 
     if (m_command == Init) {
+        stopReading();
         m_statusCode.r = 0;
         m_statusCode.Motor = 1;
         m_responseFifo.push(m_statusCode.r);
@@ -168,7 +199,7 @@ void CDROM::tryStartCommand() {
 
     if (m_command == SeekL) {
         m_disc.seek();
-        m_state = State::Idle;
+        stopReading();
         m_statusCode.r = 0;
         m_statusCode.Motor = 1;
         m_responseFifo.push(m_statusCode.r);
@@ -187,7 +218,7 @@ void CDROM::tryStartCommand() {
     }
 
     if (m_command == Pause) {
-        m_state = State::Idle;
+        stopReading();
         m_responseFifo.push(m_statusCode.r);
         m_ints.emplace(InterruptCause::INT3);
         scheduleInterrupt(120000);
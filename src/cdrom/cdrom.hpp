@@ -8,12 +8,9 @@
 
 #include "BitField.hpp"
 #include "cdrom_util.hpp"
+#include "scheduler/scheduler.hpp"
 #include "support/helpers.hpp"
 
-namespace Scheduler {
-class Scheduler;
-}
-
 namespace CDROM {
 
 union StatusCode {
@@ -150,6 +147,7 @@ class CDROM {
     void unloadDisc() { m_disc.clearDisc(); }
 
     void readSector();
+    void stopReading();
     void paramFifoStatus();
     void dataFifoStatus();
     void responseFifoStatus();
@@ -190,6 +188,16 @@ class CDROM {
   private:
     Scheduler::Scheduler& scheduler;
 
+    // Causes are delivered in FIFO order from m_ints, this only tracks when the pending ones fire.
+    // Kept sorted so the scheduler slot always holds the earliest deadline
+    static constexpr size_t MAX_PENDING_INTERRUPTS = 16;
+    std::array<u64, MAX_PENDING_INTERRUPTS> m_intDeadlines;
+    size_t m_intDeadlineCount = 0;
+
+    Scheduler::EventHandle m_readEvent;
+
+    void deliverInterrupt();
+
     const std::array<u8, 4> c_version = {0x94, 0x09, 0x19, 0xc0};
     const std::array<u8, 2> c_trayOpen = {0x11, 0x80};
     const std::array<u8, 4> c_noDisk = {0x08, 0x40, 0x0, 0x0};
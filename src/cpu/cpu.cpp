@@ -1,14 +1,31 @@
 #include "cpu.hpp"
 
+#include <string_view>
+
 #include "bus/bus.hpp"
+#include "cpu/recompiler.hpp"
 #include "support/log.hpp"
 
 namespace Cpu {
 
-Cpu::Cpu(Bus::Bus& bus) : bus(bus) { reset(); }
+Cpu::Cpu(Bus::Bus& bus) : bus(bus), recompiler(std::make_unique<Recompiler>(*this, bus)) {
+    backend = Recompiler::isSupported() ? Backend::Recompiler : Backend::CachedInterpreter;
+    addHook(SHELL_PC, [](Cpu& cpu) { cpu.bus.shellReached(); });
+    addHook(0xB0, [](Cpu& cpu) { cpu.handleKernelCalls(); });
+    reset();
+}
 
 Cpu::~Cpu() {}
 
+void Cpu::setBackend(Backend newBackend) {
+    if (newBackend == Backend::Recompiler && !Recompiler::isSupported()) {
+        Log::warn("[CPU] Recompiler is not supported on this host, using the cached interpreter\n");
+        newBackend = Backend::CachedInterpreter;
+    }
+    backend = newBackend;
+    clearBlockCache();
+}
+
 void Cpu::reset() {
     for (auto& reg : regs.gpr) {
         reg = 0;
@@ -18,6 +35,7 @@ void Cpu::reset() {
     regs.cop0.cause = 0;
     regs.cop0.bva = 0;
     regs.cop0.epc = 0;
+    interruptPending = false;
 
     delayedLoad.reset();
     memoryLoad.reset();
@@ -33,15 +51,45 @@ void Cpu::reset() {
     totalCycles = 0;
     cycleTarget = 0;
     ttyBuffer.clear();
+    clearBlockCache();
 }
 
-void Cpu::run() {}
+void Cpu::run() {
+    if (backend == Backend::Interpreter) {
+        while (totalCycles < cycleTarget) {
+            step();
+        }
+        return;
+    }
+
+    while (totalCycles < cycleTarget) {
+        // Blocks end before hooked addresses, so this sees every visit like the interpreter does
+        runHooks();
+
+        Block* block = lookupBlock(PC);
+        if (block == nullptr) {
+            // Unaligned or unmapped PC, let the interpreter raise the exception
+            interpret();
+            continue;
+        }
+
+        if (block->host != nullptr && lockstep) [[unlikely]] {
+            runLockstep(*block);
+        } else if (block->host != nullptr) {
+            block->host(this);
+        } else {
+            runBlock(*block);
+        }
+    }
+}
 
 void Cpu::step() {
+    runHooks();
+    interpret();
+}
+
+void Cpu::interpret() {
     // Fetch
-    if (PC == SHELL_PC) {
-        bus.shellReached();
-    }
     instruction = bus.fetch(PC);
 
     if ((PC % 4) != 0) {
@@ -50,62 +98,271 @@ void Cpu::step() {
         return;
     }
 
-    // Advance PC
-    currentPC = PC;
-    PC = nextPC;
-    nextPC += 4;
+    execute(basic[instruction.opcode]);
+    addCycles(Bus::CycleBias::CPI);
+}
 
-    // Update delay slot info
-    delaySlot = branch;
-    branchTakenDelaySlot = branchTaken;
-    branchTaken = false;
-    branch = false;
+inline void Cpu::execute(funcPtr handler) {
+    advancePC();
 
-    // Get opcode function from LUT and execute
-    const auto func = basic[instruction.opcode];
-    (this->*func)();
+    // Execute the decoded opcode function
+    (this->*handler)();
 
-    // Do memory access
-    if (delayedLoad.reg != memoryLoad.reg) {
-        regs.gpr[memoryLoad.reg] = memoryLoad.value;
+    retire();
+    checkInterrupts();
+}
+
+void Cpu::runBlock(Block& block) {
+    for (const auto& cached : block.code) {
+        const u32 pc = PC;
+        instruction = cached.code;
+        execute(cached.handler);
+        addCycles(cached.cycles);
+
+        // Leave the block on exceptions and taken branches, after writes to its own code, or when the scheduler needs to run
+        if (PC != pc + 4 || !block.valid || totalCycles >= cycleTarget) {
+            return;
+        }
     }
+}
 
-    memoryLoad = delayedLoad;
-    delayedLoad.reset();
+Cpu::State Cpu::saveState() const {
+    return {regs, delayedLoad, memoryLoad, writeBack, totalCycles, interruptPending, PC, nextPC, currentPC, branch, branchTaken,
+            delaySlot, branchTakenDelaySlot};
+}
 
-    // Write back registers
-    regs.writeback();
+void Cpu::loadState(const State& state) {
+    regs = state.regs;
+    delayedLoad = state.delayedLoad;
+    memoryLoad = state.memoryLoad;
+    writeBack = state.writeBack;
+    totalCycles = state.totalCycles;
+    interruptPending = state.interruptPending;
+    PC = state.PC;
+    nextPC = state.nextPC;
+    currentPC = state.currentPC;
+    branch = state.branch;
+    branchTaken = state.branchTaken;
+    delaySlot = state.delaySlot;
+    branchTakenDelaySlot = state.branchTakenDelaySlot;
+}
 
-    handleKernelCalls();
-    checkInterrupts();
+void Cpu::runLockstep(Block& block) {
+    const u32 pc = PC;
+    const State before = saveState();
+    const u64 slowAccesses = bus.getSlowAccesses();
+
+    bus.beginJournal();
+    runBlock(block);
+    bus.endJournal();
+
+    // Device accesses can not be replayed and a block that wrote to its own code no longer matches its host code, both
+    // keep the interpreter's result
+    if (bus.getSlowAccesses() != slowAccesses || !block.valid) return;
+
+    const State reference = saveState();
+    loadState(before);
+    bus.rollbackJournal();
+    block.host(this);
+
+    bool matches = true;
+    const auto mismatch = [&](std::string_view name, u32 expected, u32 actual) {
+        if (expected == actual) return;
+        Log::warn("[CPU] Lockstep mismatch in block {:#010x}: {} is {:#010x}, expected {:#010x}\n", pc, name, actual, expected);
+        matches = false;
+    };
+
+    // clang-format off
+    static constexpr std::array<std::string_view, 34> names = {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+        "hi", "lo",
+    };
+    // clang-format on
+    for (size_t i = 0; i < regs.gpr.size(); i++) {
+        mismatch(names[i], reference.regs.gpr[i], regs.gpr[i]);
+    }
+    mismatch("PC", reference.PC, PC);
+    mismatch("nextPC", reference.nextPC, nextPC);
+    mismatch("load register", reference.memoryLoad.reg, memoryLoad.reg);
+    mismatch("load value", reference.memoryLoad.value, memoryLoad.value);
 
-    addCycles(Bus::CycleBias::CPI);
+    // Carry on from the reference so one bad block is reported once instead of corrupting everything after it
+    if (!matches) loadState(reference);
 }
 
+Cpu::Block* Cpu::lookupBlock(u32 pc) {
+    if ((pc % 4) != 0) return nullptr;
+
+    Block* block = &blockCache[pc & 0x1FFFFFFF];
+    if (!block->valid) {
+        // Host code is only reclaimed by starting over with an empty cache
+        if (backend == Backend::Recompiler && recompiler->isFull()) {
+            clearBlockCache();
+            block = &blockCache[pc & 0x1FFFFFFF];
+        }
+        compileBlock(*block, pc);
+    }
+
+    return block->valid ? block : nullptr;
+}
+
+void Cpu::compileBlock(Block& block, u32 pc) {
+    block.code.clear();
+    block.host = nullptr;
+
+    bool inDelaySlot = false;
+    for (u32 i = 0; i < MAX_BLOCK_SIZE; i++) {
+        const u32 address = pc + i * 4;
+
+        // Blocks stop short of hooked addresses so the hook check at block entry still sees them
+        if (i != 0 && isHooked(address)) break;
+
+        const u32* code = bus.getFetchPointer(address);
+        if (code == nullptr) break;
+
+        const u32 cycles = Bus::CycleBias::CPI + bus.fetchCycles(address);
+        block.code.push_back({decode(*code), *code, cycles});
+
+        if (inDelaySlot) break;
+        if (raisesException(*code)) break;
+        inDelaySlot = isBranch(*code);
+
+        // Keep blocks inside a single code page unless the delay slot crosses it
+        if (!inDelaySlot && ((address + 4) & ((1 << CODE_PAGE_SHIFT) - 1)) == 0) break;
+    }
+
+    if (block.code.empty()) return;
+
+    // Only RAM can be written, register the pages the block lives in for invalidation
+    const u32 start = pc & 0x1FFFFFFF;
+    const u32 end = start + static_cast<u32>(block.code.size() - 1) * 4;
+    if (start < 0x800000) {
+        for (const u32 address : {start, end}) {
+            const u32 page = (address & (RAM_SIZE - 1)) >> CODE_PAGE_SHIFT;
+            codePageBlocks[page].push_back(start);
+            codePages[page] = true;
+        }
+    }
+
+    block.valid = true;
+
+    if (backend == Backend::Recompiler) {
+        block.host = recompiler->compile(block, pc);
+    }
+}
+
+Cpu::funcPtr Cpu::decode(u32 code) const {
+    Instruction instr{code};
+    if (instr.opcode == 0) {
+        return special[instr.fn];
+    }
+    return basic[instr.opcode];
+}
+
+bool Cpu::isBranch(u32 code) {
+    Instruction instr{code};
+    switch (instr.opcode) {
+        // REGIMM, J, JAL, BEQ, BNE, BLEZ, BGTZ
+        case 0x01:
+        case 0x02:
+        case 0x03:
+        case 0x04:
+        case 0x05:
+        case 0x06:
+        case 0x07: return true;
+        // JR, JALR
+        case 0x00: return instr.fn == 0x08 || instr.fn == 0x09;
+        default: return false;
+    }
+}
+
+bool Cpu::raisesException(u32 code) {
+    Instruction instr{code};
+    // SYSCALL, BREAK
+    return instr.opcode == 0x00 && (instr.fn == 0x0C || instr.fn == 0x0D);
+}
+
+void Cpu::invalidateCodePage(u32 page) {
+    for (const u32 address : codePageBlocks[page]) {
+        if (auto it = blockCache.find(address); it != blockCache.end()) {
+            it->second.valid = false;
+        }
+    }
+    codePageBlocks[page].clear();
+    codePages[page] = false;
+}
+
+void Cpu::clearBlockCache() {
+    blockCache.clear();
+    for (auto& blocks : codePageBlocks) {
+        blocks.clear();
+    }
+    codePages.fill(false);
+    recompiler->reset();
+}
+
+// Stale blocks recompile on their next lookup, their host code is reclaimed with the rest once the buffer fills
+void Cpu::invalidateBlocks() {
+    for (auto& [address, block] : blockCache) {
+        block.valid = false;
+    }
+    for (auto& blocks : codePageBlocks) {
+        blocks.clear();
+    }
+    codePages.fill(false);
+}
+
+void Cpu::addHook(u32 address, Hook hook) {
+    const u32 key = hookKey(address);
+    hooks[key].push_back(std::move(hook));
+    hookPages[key >> HOOK_PAGE_SHIFT] = true;
+
+    // Blocks compiled before may run straight through the address. They are only marked stale, the one running the hook
+    // that got here finishes first
+    if (key < RAM_SIZE) {
+        invalidateCodePage(key >> CODE_PAGE_SHIFT);
+        return;
+    }
+    for (auto& [start, block] : blockCache) {
+        if (key >= start && key < start + block.code.size() * 4) block.valid = false;
+    }
+}
+
+void Cpu::removeHooks(u32 address) {
+    const u32 key = hookKey(address);
+    hooks.erase(key);
+
+    const u32 page = key >> HOOK_PAGE_SHIFT;
+    hookPages[page] = false;
+    for (const auto& [hooked, list] : hooks) {
+        if ((hooked >> HOOK_PAGE_SHIFT) == page) {
+            hookPages[page] = true;
+            break;
+        }
+    }
+}
+
+// B0 kernel call vector hook
 void Cpu::handleKernelCalls() {
-    const u32 pc = PC & 0x1FFFFF;
     const u32 func = regs.gpr[9];
 
-    if (pc == 0xB0) {
-        switch (func) {
-            // putchar
-            case 0x3D: {
-                const char c = regs.gpr[A0];
-                Log::info("{}", c);
-                break;
-            }
-            case 0x08: {
-                const u32 e = regs.gpr[A0];
-                Log::info("[OpenEvent] {} - {:#08X}\n", magic_enum::enum_name<KernelEvents>(static_cast<KernelEvents>(e & 0xFFFFFFF)), e);
-                break;
-            }
+    switch (func) {
+        // putchar
+        case 0x3D: {
+            const auto c = static_cast<char>(regs.gpr[A0]);
+            Log::info("{}", c);
+            break;
+        }
+        case 0x08: {
+            const u32 e = regs.gpr[A0];
+            Log::info("[OpenEvent] {} - {:#08X}\n", magic_enum::enum_name<KernelEvents>(static_cast<KernelEvents>(e & 0xFFFFFFF)), e);
+            break;
         }
     }
 }
 
-void Cpu::triggerInterrupt() {}
-
-void Cpu::checkInterrupts() {
+void Cpu::updateInterrupts() {
     if (bus.isIRQPending()) {
         regs.cop0.cause |= static_cast<u32>(0x400);
     } else {
@@ -116,9 +373,7 @@ void Cpu::checkInterrupts() {
     u8 im = (regs.cop0.status >> 8) & 0xFF;
     u8 ip = (regs.cop0.cause >> 8) & 0xFF;
 
-    if (iec && (im & ip) > 0) {
-        ExceptionHandler(Exception::Interrupt);
-    }
+    interruptPending = iec && (im & ip) > 0;
 }
 
 void Cpu::Unknown() { Helpers::panic("[CPU] Unknown instruction at {:#x}, opcode {:#x}\n", PC, instruction.code); }
@@ -133,8 +388,8 @@ void Cpu::ExceptionHandler(Exception cause, u32 cop) {
     sr = (sr & ~0x3f);
     sr = sr | ((mode << 2) & 0x3F);
 
-    regs.cop0.cause &= ~0x7C;
-    regs.cop0.cause = static_cast<u32>(cause) << 2;
+    // The hardware interrupt bit follows ISTAT & IMASK, it is not part of the exception state
+    regs.cop0.cause = (regs.cop0.cause & 0x400) | (static_cast<u32>(cause) << 2);
 
     if (cause == Exception::Interrupt) {
         regs.cop0.epc = PC;
@@ -155,6 +410,7 @@ void Cpu::ExceptionHandler(Exception cause, u32 cop) {
     }
 
     setPC(vector);
+    updateInterrupts();
     //    Log::debug("ExceptionHandler at PC {:#08x}\n", currentPC);
 }
 
@@ -166,6 +422,7 @@ void Cpu::RFE() {
     u32 mode = regs.cop0.status & 0x3F;
     regs.cop0.status &= ~(u32)0xF;
     regs.cop0.status |= mode >> 2;
+    updateInterrupts();
     //    Log::debug("Return from Exception\n");
 }
 
@@ -574,6 +831,7 @@ void Cpu::MTC0() {
     } else if (rd == 12) {
         regs.cop0.status = val;
     }
+    updateInterrupts();
 
     u32 imask = (val >> 8) & 0x3;
     u32 ipending = (regs.cop0.cause >> 8) & 0x3;
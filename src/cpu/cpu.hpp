@@ -1,7 +1,12 @@
 #pragma once
 #include <array>
+#include <bitset>
 #include <cassert>
+#include <functional>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "BitField.hpp"
 #include "magic_enum.hpp"
@@ -12,6 +17,8 @@ class Bus;
 }
 
 namespace Cpu {
+class Recompiler;
+
 // clang-format off
 enum : u32 {
     ZERO, AT, V0, V1, A0, A1, A2, A3, T0, T1, T2, T3, T4, T5, T6, T7,
@@ -99,6 +106,12 @@ enum class KernelEvents : u32 {
     VerticalRetrace = 0x2000003,
 };
 
+enum class Backend {
+    Interpreter,        // Fetch and decode every instruction, reference implementation
+    CachedInterpreter,  // Execute predecoded basic blocks from the block cache
+    Recompiler,         // Translate blocks from the block cache to host code, x86-64 only
+};
+
 struct Cop0Regs {
     u32 cause;
     u32 status;
@@ -141,6 +154,32 @@ class Cpu {
     void step();
     void run();
 
+    // Hooks run before the instruction at a physical address executes: sideloading, TTY capture, kernel call tracing, HLE.
+    // RAM mirrors share their hooks. Backends only look them up at block entry, blocks never extend past a hooked address.
+    // A hook may redirect PC and add hooks of its own
+    using Hook = std::function<void(Cpu&)>;
+    void addHook(u32 address, Hook hook);
+    void removeHooks(u32 address);
+
+    void setBackend(Backend newBackend);
+    [[nodiscard]] auto getBackend() const -> Backend { return backend; }
+
+    // Debugging aid for the recompiler. Every compiled block first runs through the interpreter, then from the same state as
+    // host code, and any difference in the GPRs, HI/LO, PC or pending load is logged. Blocks that reach devices can not be
+    // replayed and only run interpreted
+    void setLockstep(bool enabled) { lockstep = enabled; }
+
+    // Called by the bus on every RAM write so stale blocks are never executed
+    void invalidateCode(u32 address) {
+        const u32 page = (address & (RAM_SIZE - 1)) >> CODE_PAGE_SHIFT;
+        if (codePages[page]) {
+            invalidateCodePage(page);
+        }
+    }
+    void clearBlockCache();
+    // Marks every block stale without freeing anything, safe to call from inside a running block
+    void invalidateBlocks();
+
     [[nodiscard]] auto getPC() const -> u32 { return PC; }
 
     void setPC(u32 pc) {
@@ -156,12 +195,126 @@ class Cpu {
     [[nodiscard]] auto getCycleTarget() const -> Cycles { return cycleTarget; }
     void setCycleTarget(Cycles cycles) { cycleTarget = cycles; }
     void addCycles(Cycles cycles) { totalCycles += cycles; }
-    void triggerInterrupt();
+
+    // Recomputes the interrupt line, the Bus calls this whenever ISTAT or IMASK change
+    void updateInterrupts();
 
   private:
+    friend class Recompiler;
+
+    // Predecoded instruction, the handler is resolved through the opcode tables once at compile time
+    struct CachedInstruction {
+        funcPtr handler;
+        u32 code;
+        u32 cycles;
+    };
+
+    struct Block {
+        std::vector<CachedInstruction> code;
+        void (*host)(Cpu*) = nullptr;
+        bool valid = false;
+    };
+
+    static constexpr u32 RAM_SIZE = 2_MB;
+    static constexpr u32 CODE_PAGE_SHIFT = 12;
+    static constexpr u32 CODE_PAGES = RAM_SIZE >> CODE_PAGE_SHIFT;
+    static constexpr u32 MAX_BLOCK_SIZE = 128;
+
     Bus::Bus& bus;
+    void interpret();
+    void execute(funcPtr handler);
     void handleKernelCalls();
-    void checkInterrupts();
+
+    static constexpr u32 HOOK_PAGE_SHIFT = 12;
+    static u32 hookKey(u32 address) {
+        const u32 physical = address & 0x1FFFFFFF;
+        return physical < 8_MB ? physical & (RAM_SIZE - 1) : physical;
+    }
+
+    std::unordered_map<u32, std::vector<Hook>> hooks;
+    std::bitset<((1u << 29) >> HOOK_PAGE_SHIFT)> hookPages;
+
+    [[nodiscard]] bool isHooked(u32 address) const {
+        const u32 key = hookKey(address);
+        return hookPages[key >> HOOK_PAGE_SHIFT] && hooks.contains(key);
+    }
+
+    void runHooks() {
+        const u32 key = hookKey(PC);
+        if (!hookPages[key >> HOOK_PAGE_SHIFT]) return;
+        if (auto it = hooks.find(key); it != hooks.end()) {
+            for (const auto& hook : it->second) {
+                hook(*this);
+            }
+        }
+    }
+
+    void advancePC() {
+        currentPC = PC;
+        PC = nextPC;
+        nextPC += 4;
+
+        // Update delay slot info
+        delaySlot = branch;
+        branchTakenDelaySlot = branchTaken;
+        branchTaken = false;
+        branch = false;
+    }
+
+    // Resolve the load delay slot and write back the result of the instruction
+    void retire() {
+        if (delayedLoad.reg != memoryLoad.reg) {
+            regs.gpr[memoryLoad.reg] = memoryLoad.value;
+        }
+
+        memoryLoad = delayedLoad;
+        delayedLoad.reset();
+
+        regs.writeback();
+    }
+
+    // Only tests the cached line, updateInterrupts() keeps it current on ISTAT/IMASK/SR/CAUSE changes
+    void checkInterrupts() {
+        if (interruptPending) [[unlikely]] {
+            ExceptionHandler(Exception::Interrupt);
+        }
+    }
+
+    // Everything a block can change in the Cpu itself
+    struct State {
+        Regs regs;
+        Writeback delayedLoad;
+        Writeback memoryLoad;
+        Writeback writeBack;
+        Cycles totalCycles;
+        bool interruptPending;
+        u32 PC;
+        u32 nextPC;
+        u32 currentPC;
+        bool branch;
+        bool branchTaken;
+        bool delaySlot;
+        bool branchTakenDelaySlot;
+    };
+
+    State saveState() const;
+    void loadState(const State& state);
+    void runLockstep(Block& block);
+
+    void runBlock(Block& block);
+    Block* lookupBlock(u32 pc);
+    void compileBlock(Block& block, u32 pc);
+    funcPtr decode(u32 code) const;
+    static bool isBranch(u32 code);
+    static bool raisesException(u32 code);
+    void invalidateCodePage(u32 page);
+
+    Backend backend = Backend::CachedInterpreter;
+    bool lockstep = false;
+    std::unique_ptr<Recompiler> recompiler;
+    std::unordered_map<u32, Block> blockCache;
+    std::array<std::vector<u32>, CODE_PAGES> codePageBlocks;
+    std::array<bool, CODE_PAGES> codePages{};
 
     Instruction instruction{0};
     Regs regs;
@@ -173,6 +326,9 @@ class Cpu {
     Cycles totalCycles;
     Cycles cycleTarget;
 
+    // SR.IEc is set and a pending interrupt in CAUSE.IP is unmasked in SR.IM
+    bool interruptPending = false;
+
     u32 PC;
     u32 nextPC;
     u32 currentPC;
@@ -283,7 +439,7 @@ class Cpu {
     void RTPT();
     void SQR();
 
-    const funcPtr basic[64] = {
+    static constexpr funcPtr basic[64] = {
         &Cpu::Special, &Cpu::REGIMM,  &Cpu::J,       &Cpu::JAL,     &Cpu::BEQ,     &Cpu::BNE,     &Cpu::BLEZ,    &Cpu::BGTZ,
         &Cpu::ADDI,    &Cpu::ADDIU,   &Cpu::SLTI,    &Cpu::SLTIU,   &Cpu::ANDI,    &Cpu::ORI,     &Cpu::XORI,    &Cpu::LUI,
         &Cpu::COP0,    &Cpu::Unknown, &Cpu::COP2,    &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown,
@@ -295,7 +451,7 @@ class Cpu {
 
     };
 
-    const funcPtr special[64] = {
+    static constexpr funcPtr special[64] = {
         &Cpu::SLL,     &Cpu::Unknown, &Cpu::SRL,     &Cpu::SRA,     &Cpu::SLLV,    &Cpu::Unknown, &Cpu::SRLV,    &Cpu::SRAV,
         &Cpu::JR,      &Cpu::JALR,    &Cpu::Unknown, &Cpu::Unknown, &Cpu::SYSCALL, &Cpu::BREAK,   &Cpu::Unknown, &Cpu::Unknown,
         &Cpu::MFHI,    &Cpu::MTHI,    &Cpu::MFLO,    &Cpu::MTLO,    &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown,
@@ -306,7 +462,7 @@ class Cpu {
         &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown,
     };
 
-    const funcPtr gte[64] = {
+    static constexpr funcPtr gte[64] = {
         &Cpu::GTEMove, &Cpu::RTPS,    &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::NCLIP,   &Cpu::Unknown,
         &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown, &Cpu::OP,      &Cpu::Unknown, &Cpu::Unknown, &Cpu::Unknown,
         &Cpu::DPCS,    &Cpu::INTPL,   &Cpu::MVMVA,   &Cpu::NCDS,    &Cpu::CDP,     &Cpu::Unknown, &Cpu::NCDT,    &Cpu::Unknown,
@@ -0,0 +1,649 @@
+#include "recompiler.hpp"
+
+#include <utility>
+
+#include "bus/bus.hpp"
+#include "support/log.hpp"
+
+#ifdef SHITSTATION_HOST_FASTMEM
+#include "bus/hostmemory.hpp"
+#endif
+
+#ifdef RECOMPILER_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace Cpu {
+
+using namespace X64;
+
+namespace {
+constexpr u32 NO_REG = ~0u;
+
+bool isLoad(Instruction instr) { return (instr.opcode >= 0x20 && instr.opcode <= 0x26) || (instr.opcode == 0x10 && instr.rs == 0); }
+bool isStore(Instruction instr) { return instr.opcode >= 0x28 && instr.opcode <= 0x2E; }
+
+// MTC0/RFE and MMIO writes are the only instructions that change whether an interrupt can be taken
+bool affectsInterrupts(Instruction instr) { return instr.opcode == 0x10 || isStore(instr); }
+
+// Handlers that only touch registers, they never raise exceptions or read PC
+bool isPure(Instruction instr) {
+    switch (instr.opcode) {
+        case 0x00: return (instr.fn >= 0x10 && instr.fn <= 0x13) || (instr.fn >= 0x18 && instr.fn <= 0x1B);
+        case 0x12:
+        case 0x32:
+        case 0x3A: return true;
+        default: return false;
+    }
+}
+}  // namespace
+
+template <Cpu::funcPtr handler>
+void Recompiler::interpret(Cpu* cpu) {
+    (cpu->*handler)();
+    cpu->retire();
+}
+
+template <const Cpu::funcPtr* table, size_t... I>
+constexpr std::array<Recompiler::HostCode, 64> Recompiler::makeThunks(std::index_sequence<I...>) {
+    return {&interpret<table[I]>...};
+}
+
+void Recompiler::takeInterrupt(Cpu* cpu) { cpu->checkInterrupts(); }
+
+void Recompiler::invalidateCode(Cpu* cpu, u32 address) { cpu->invalidateCode(address); }
+
+bool Recompiler::handleFastmemFault(void* context, uintptr_t pc, uintptr_t& resume) {
+    const auto& sites = static_cast<Recompiler*>(context)->fastmemSites;
+    const auto site = sites.find(pc);
+    if (site == sites.end()) return false;
+    // An access that faulted once keeps hitting something other than RAM, later runs go to the slow path directly
+    Emitter::patchJump(site->second.patch, site->second.slow);
+    resume = reinterpret_cast<uintptr_t>(site->second.slow);
+    return true;
+}
+
+Recompiler::Recompiler(Cpu& owner, Bus::Bus& memory) : cpu(owner), bus(memory) {
+    gprOffset = offsetOf(cpu.regs.gpr);
+    statusOffset = offsetOf(cpu.regs.cop0.status);
+    pcOffset = offsetOf(cpu.PC);
+    nextPCOffset = offsetOf(cpu.nextPC);
+    currentPCOffset = offsetOf(cpu.currentPC);
+    branchOffset = offsetOf(cpu.branch);
+    instructionOffset = offsetOf(cpu.instruction);
+    memoryLoadOffset = offsetOf(cpu.memoryLoad);
+    cyclesOffset = offsetOf(cpu.totalCycles);
+    codePagesOffset = offsetOf(cpu.codePages);
+    interruptOffset = offsetOf(cpu.interruptPending);
+
+    // The four branch flags are cleared and shifted into the delay slot flags a word at a time
+    assert(offsetOf(cpu.branchTaken) == branchOffset + 1);
+    assert(offsetOf(cpu.delaySlot) == branchOffset + 2);
+    assert(offsetOf(cpu.branchTakenDelaySlot) == branchOffset + 3);
+
+#ifdef RECOMPILER_X64
+#ifdef _WIN32
+    codeBuffer = static_cast<u8*>(VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+    void* buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    codeBuffer = buffer == MAP_FAILED ? nullptr : static_cast<u8*>(buffer);
+#endif
+    if (codeBuffer == nullptr) {
+        Helpers::panic("[JIT] Failed to allocate the code buffer\n");
+    }
+    emitter.setBuffer(codeBuffer, CODE_BUFFER_SIZE);
+
+#ifdef SHITSTATION_HOST_FASTMEM
+    fastmemBase = bus.getFastmemBase();
+    if (fastmemBase != nullptr) {
+        bus.hostMemory.setFaultCallback(&handleFastmemFault, this);
+    }
+#endif
+#endif
+}
+
+Recompiler::~Recompiler() {
+#ifdef RECOMPILER_X64
+#ifdef SHITSTATION_HOST_FASTMEM
+    if (fastmemBase != nullptr) {
+        bus.hostMemory.setFaultCallback(nullptr, nullptr);
+    }
+#endif
+#ifdef _WIN32
+    VirtualFree(codeBuffer, 0, MEM_RELEASE);
+#else
+    munmap(codeBuffer, CODE_BUFFER_SIZE);
+#endif
+#endif
+}
+
+void Recompiler::reset() {
+    emitter.rewind();
+    fastmemSites.clear();
+}
+
+bool Recompiler::isFull() const { return emitter.remaining() < (Cpu::MAX_BLOCK_SIZE + 1) * MAX_INSTRUCTION_SIZE; }
+
+Recompiler::HostCode Recompiler::compile(const Cpu::Block& block, u32 pc) {
+    if constexpr (!isSupported()) return nullptr;
+    if (isFull()) return nullptr;
+
+    const auto entry = reinterpret_cast<HostCode>(emitter.current());
+    epilogue = {};
+    labels.clear();
+    farCode.clear();
+    pendingSites.clear();
+
+    // RBX holds the Cpu pointer for the whole block, the extra 32 bytes keep RSP aligned and cover the Win64 shadow space
+    emitter.push(RBX);
+    emitter.alu64(Alu::Sub, RSP, 32);
+    emitter.mov64(RBX, ARG0);
+
+    Context ctx{};
+    ctx.block = &block;
+    ctx.loadState = LoadState::Unknown;
+
+    bool delaySlot = false;
+    for (size_t i = 0; i < block.code.size(); i++) {
+        const auto& cached = block.code[i];
+        ctx.address = pc + static_cast<u32>(i) * 4;
+        ctx.code = cached.code;
+        ctx.cycles = cached.cycles;
+        ctx.index = i;
+        ctx.dynamic = i == 0 || delaySlot;
+        ctx.last = i == block.code.size() - 1;
+
+        compileInstruction(ctx);
+        delaySlot = Cpu::isBranch(cached.code);
+    }
+
+    if (ctx.stateDirty) {
+        materializePC(ctx);
+    }
+    flushCycles(ctx);
+
+    emitter.bind(epilogue);
+    emitter.alu64(Alu::Add, RSP, 32);
+    emitter.pop(RBX);
+    emitter.ret();
+
+    // Slow paths and block exits, out of line so the common path falls straight through
+    for (size_t i = 0; i < farCode.size(); i++) {
+        farCode[i]();
+    }
+
+    for (const auto& [access, patch, slow] : pendingSites) {
+        fastmemSites[reinterpret_cast<uintptr_t>(codeBuffer + access)] = {codeBuffer + patch, codeBuffer + slow->position};
+    }
+
+    return entry;
+}
+
+void Recompiler::compileInstruction(Context& ctx) {
+    if (ctx.dynamic) {
+        advancePC();
+        ctx.flagsClean = false;
+    }
+
+    // The pending load is only known statically once the block has executed one instruction
+    bool inlined = false;
+    if (ctx.loadState != LoadState::Unknown) {
+        inlined = compileALU(ctx) || compileLoad(ctx) || compileStore(ctx);
+    }
+
+    if (!inlined) {
+        compileFallback(ctx);
+
+        Instruction instr{ctx.code};
+        ctx.pendingCycles = ctx.cycles;
+        ctx.stateDirty = isPure(instr) && !ctx.dynamic;
+        ctx.loadState = isLoad(instr) ? LoadState::Pending : LoadState::None;
+        ctx.loadReg = instr.rt;
+    } else {
+        ctx.stateDirty = !ctx.dynamic;
+    }
+}
+
+void Recompiler::compileFallback(Context& ctx) {
+    const Instruction instr{ctx.code};
+    const bool pure = isPure(instr);
+
+    flushCycles(ctx);
+    if (!ctx.dynamic && !pure) {
+        materializePC(ctx);
+    }
+
+    static constexpr auto basicThunks = makeThunks<Cpu::basic>(std::make_index_sequence<64>{});
+    static constexpr auto specialThunks = makeThunks<Cpu::special>(std::make_index_sequence<64>{});
+
+    emitter.store32(field(instructionOffset), ctx.code);
+    callCpu(reinterpret_cast<const void*>(instr.opcode == 0 ? specialThunks[instr.fn] : basicThunks[instr.opcode]));
+
+    // The first instruction of a block picks up interrupts raised by the scheduler since the last block
+    const bool irq = ctx.index == 0 || affectsInterrupts(instr);
+    if (irq) {
+        checkInterrupts();
+    }
+
+    if (pure && ctx.index != 0) return;
+
+    // Stores can reach DMA, which may overwrite the block that is running
+    if (isStore(instr)) {
+        emitter.mov64(RAX, reinterpret_cast<u64>(&ctx.block->valid));
+        emitter.cmp8({RAX}, 0);
+        emitter.jcc(Cond::E, exitLabel(ctx.cycles, nullptr));
+    }
+
+    // Exceptions and taken interrupts leave the block, delay slots at the end of a block are allowed to branch
+    if (!ctx.last || !ctx.dynamic) {
+        emitter.alu32(Alu::Cmp, field(pcOffset), ctx.address + 4);
+        emitter.jcc(Cond::NE, exitLabel(ctx.cycles, nullptr));
+    } else if (!irq) {
+        checkInterrupts();
+    }
+}
+
+bool Recompiler::compileALU(Context& ctx) {
+    const Instruction instr{ctx.code};
+    u32 dest = 0;
+    std::function<void()> compute;
+
+    const u32 rs = instr.rs;
+    const u32 rt = instr.rt;
+    const u32 rd = instr.rd;
+    const u32 sa = instr.sa;
+    const u32 imm = instr.imm;
+    const u32 immse = static_cast<u32>(instr.immse);
+
+    auto binary = [&](Alu op, bool invert = false) {
+        dest = rd;
+        compute = [this, op, invert, rs, rt] {
+            loadReg(RAX, rs);
+            loadReg(RCX, rt);
+            emitter.alu32(op, RAX, RCX);
+            if (invert) emitter.not32(RAX);
+        };
+    };
+
+    auto shiftImm = [&](Shift op) {
+        dest = rd;
+        compute = [this, op, rt, sa] {
+            loadReg(RAX, rt);
+            if (sa != 0) emitter.shift32(op, RAX, static_cast<u8>(sa));
+        };
+    };
+
+    auto shiftVar = [&](Shift op) {
+        dest = rd;
+        compute = [this, op, rs, rt] {
+            loadReg(RAX, rt);
+            loadReg(RCX, rs);
+            emitter.shift32(op, RAX);
+        };
+    };
+
+    auto compare = [&](Cond cond, bool immediate) {
+        dest = immediate ? rt : rd;
+        compute = [this, cond, immediate, rs, rt, immse] {
+            loadReg(RCX, rs);
+            if (!immediate) loadReg(RDX, rt);
+            emitter.mov32(RAX, 0u);
+            if (immediate) {
+                emitter.alu32(Alu::Cmp, RCX, immse);
+            } else {
+                emitter.alu32(Alu::Cmp, RCX, RDX);
+            }
+            emitter.setcc(cond, RAX);
+        };
+    };
+
+    auto immediate = [&](Alu op, u32 value) {
+        dest = rt;
+        compute = [this, op, rs, value] {
+            loadReg(RAX, rs);
+            if (value != 0 || op == Alu::And) emitter.alu32(op, RAX, value);
+        };
+    };
+
+    auto moveHiLo = [&](u32 from, u32 to) {
+        // MTHI/MTLO write HI/LO directly, MFHI/MFLO go through the normal writeback
+        dest = to < HI ? to : 0;
+        compute = [this, from, to] {
+            if (from < HI) {
+                loadReg(RAX, from);
+            } else {
+                emitter.load32(RAX, gpr(from));
+            }
+            if (to >= HI) emitter.store32(gpr(to), RAX);
+        };
+    };
+
+    switch (instr.opcode) {
+        case 0x00: {
+            switch (instr.fn) {
+                case 0x00: shiftImm(Shift::Shl); break;
+                case 0x02: shiftImm(Shift::Shr); break;
+                case 0x03: shiftImm(Shift::Sar); break;
+                case 0x04: shiftVar(Shift::Shl); break;
+                case 0x06: shiftVar(Shift::Shr); break;
+                case 0x07: shiftVar(Shift::Sar); break;
+                case 0x10: moveHiLo(HI, rd); break;
+                case 0x11: moveHiLo(rs, HI); break;
+                case 0x12: moveHiLo(LO, rd); break;
+                case 0x13: moveHiLo(rs, LO); break;
+                case 0x21: binary(Alu::Add); break;
+                case 0x23: binary(Alu::Sub); break;
+                case 0x24: binary(Alu::And); break;
+                case 0x25: binary(Alu::Or); break;
+                case 0x26: binary(Alu::Xor); break;
+                case 0x27: binary(Alu::Or, true); break;
+                case 0x2A: compare(Cond::L, false); break;
+                case 0x2B: compare(Cond::B, false); break;
+                default: return false;
+            }
+            break;
+        }
+        case 0x09: immediate(Alu::Add, immse); break;
+        case 0x0A: compare(Cond::L, true); break;
+        case 0x0B: compare(Cond::B, true); break;
+        case 0x0C: immediate(Alu::And, imm); break;
+        case 0x0D: immediate(Alu::Or, imm); break;
+        case 0x0E: immediate(Alu::Xor, imm); break;
+        case 0x0F: {
+            dest = rt;
+            compute = [this, imm] { emitter.mov32(RAX, imm << 16); };
+            break;
+        }
+        default: return false;
+    }
+
+    // Writes to $zero are dropped, only MTHI/MTLO have to run for their side effect
+    const bool hiLo = instr.opcode == 0x00 && (instr.fn == 0x11 || instr.fn == 0x13);
+    if (dest != 0 || hiLo) {
+        compute();
+    }
+
+    resolveLoad(ctx, NO_REG);
+    if (dest != 0) {
+        emitter.store32(gpr(dest), RAX);
+    }
+
+    ctx.pendingCycles += ctx.cycles;
+    ctx.loadState = LoadState::None;
+    return true;
+}
+
+bool Recompiler::compileLoad(Context& ctx) {
+    const Instruction instr{ctx.code};
+    u32 alignMask = 0;
+    switch (instr.opcode) {
+        case 0x20:
+        case 0x24: break;
+        case 0x21:
+        case 0x25: alignMask = 1; break;
+        case 0x23: alignMask = 3; break;
+        default: return false;
+    }
+
+    auto& slow = labels.emplace_back();
+    auto& done = labels.emplace_back();
+
+    computeAddress(ctx);
+    if (alignMask != 0) {
+        emitter.test32(RCX, alignMask);
+        emitter.jcc(Cond::NE, slow);
+    }
+    emitter.test32(field(statusOffset), 1 << 16);
+    emitter.jcc(Cond::NE, slow);
+
+    // Pages slower than RAM (BIOS, expansion regions) are left to the bus, which charges their wait states
+    const size_t width = alignMask == 0 ? Bus::Bus::BYTE : alignMask == 1 ? Bus::Bus::HALF : Bus::Bus::WORD;
+    emitter.mov32(RDX, RCX);
+    emitter.shift32(Shift::Shr, RDX, 16);
+    emitter.mov32(RAX, RDX);
+    emitter.alu32(Alu::And, RAX, Bus::Bus::PHYSICAL_PAGES - 1);
+    emitter.mov64(R8, reinterpret_cast<u64>(bus.waitStates[width].data()));
+    emitter.cmp8({R8, 0, RAX, 1}, Bus::CycleBias::RAM);
+    emitter.jcc(Cond::NE, slow);
+
+    if (fastmemBase != nullptr) {
+        addFastmemSite(slow);
+    } else {
+        emitter.mov64(RAX, reinterpret_cast<u64>(bus.readPages));
+        emitter.load64(RAX, {RAX, 0, RDX, 8});
+        emitter.test64(RAX, RAX);
+        emitter.jcc(Cond::E, slow);
+        emitter.alu32(Alu::And, RCX, 0xFFFF);
+    }
+
+    const Mem host{RAX, 0, RCX, 1};
+    switch (instr.opcode) {
+        case 0x20: emitter.load8(RAX, host, true); break;
+        case 0x24: emitter.load8(RAX, host, false); break;
+        case 0x21: emitter.load16(RAX, host, true); break;
+        case 0x25: emitter.load16(RAX, host, false); break;
+        default: emitter.load32(RAX, host); break;
+    }
+
+    // A load to the same register cancels the one still in flight
+    resolveLoad(ctx, instr.rt);
+    emitter.store32(field(memoryLoadOffset), instr.rt);
+    emitter.store32(field(memoryLoadOffset + 4), RAX);
+    emitter.bind(done);
+
+    farCode.emplace_back([this, ctx, &slow, &done] {
+        emitter.bind(slow);
+        Context far = ctx;
+        compileFallback(far);
+        reconcileCycles(ctx.pendingCycles);
+        emitter.jmp(done);
+    });
+
+    ctx.pendingCycles += ctx.cycles + Bus::CycleBias::RAM;
+    ctx.loadState = LoadState::Pending;
+    ctx.loadReg = instr.rt;
+    return true;
+}
+
+bool Recompiler::compileStore(Context& ctx) {
+    const Instruction instr{ctx.code};
+    u32 alignMask = 0;
+    switch (instr.opcode) {
+        case 0x28: break;
+        case 0x29: alignMask = 1; break;
+        case 0x2B: alignMask = 3; break;
+        default: return false;
+    }
+
+    auto& slow = labels.emplace_back();
+    auto& invalidate = labels.emplace_back();
+    auto& done = labels.emplace_back();
+
+    computeAddress(ctx);
+    if (alignMask != 0) {
+        emitter.test32(RCX, alignMask);
+        emitter.jcc(Cond::NE, slow);
+    }
+    emitter.test32(field(statusOffset), 1 << 16);
+    emitter.jcc(Cond::NE, slow);
+
+    loadReg(R8, instr.rt);
+    if (fastmemBase != nullptr) {
+        emitter.mov32(RDX, RCX);
+        addFastmemSite(slow);
+    } else {
+        emitter.mov32(RDX, RCX);
+        emitter.shift32(Shift::Shr, RDX, 16);
+        emitter.mov64(RAX, reinterpret_cast<u64>(bus.writePages));
+        emitter.load64(RAX, {RAX, 0, RDX, 8});
+        emitter.test64(RAX, RAX);
+        emitter.jcc(Cond::E, slow);
+        emitter.mov32(RDX, RCX);
+        emitter.alu32(Alu::And, RDX, 0xFFFF);
+    }
+
+    const Mem host{RAX, 0, RDX, 1};
+    switch (instr.opcode) {
+        case 0x28: emitter.store8(host, R8); break;
+        case 0x29: emitter.store16(host, R8); break;
+        default: emitter.store32(host, R8); break;
+    }
+    resolveLoad(ctx, NO_REG);
+
+    // Same check as Cpu::invalidateCode, the call only happens for pages holding compiled code. Only the first 8MB of a
+    // segment hold RAM, a store anywhere else in the fastmem window must not be taken for a RAM page
+    emitter.mov32(RDX, RCX);
+    if (fastmemBase != nullptr) {
+        emitter.alu32(Alu::And, RDX, 0x1FFFFFFF);
+        emitter.alu32(Alu::Cmp, RDX, static_cast<u32>(8_MB));
+        emitter.jcc(Cond::AE, done);
+    }
+    emitter.alu32(Alu::And, RDX, Cpu::RAM_SIZE - 1);
+    emitter.shift32(Shift::Shr, RDX, Cpu::CODE_PAGE_SHIFT);
+    emitter.cmp8({RBX, codePagesOffset, RDX, 1}, 0);
+    emitter.jcc(Cond::NE, invalidate);
+    emitter.bind(done);
+
+    farCode.emplace_back([this, ctx, &slow, &done] {
+        emitter.bind(slow);
+        Context far = ctx;
+        compileFallback(far);
+        reconcileCycles(ctx.pendingCycles);
+        emitter.jmp(done);
+    });
+
+    const u32 cycles = ctx.pendingCycles + ctx.cycles + Bus::CycleBias::RAM;
+    farCode.emplace_back([this, ctx, cycles, &invalidate, &done] {
+        emitter.bind(invalidate);
+        emitter.mov32(ARG1, RCX);
+        callCpu(reinterpret_cast<const void*>(&invalidateCode));
+
+        // Leave if the store hit the block itself
+        emitter.mov64(RAX, reinterpret_cast<u64>(&ctx.block->valid));
+        emitter.cmp8({RAX}, 0);
+        emitter.jcc(Cond::E, exitLabel(cycles, &ctx));
+        emitter.jmp(done);
+    });
+
+    ctx.pendingCycles = cycles;
+    ctx.loadState = LoadState::None;
+    return true;
+}
+
+void Recompiler::advancePC() {
+    // currentPC = PC; PC = nextPC; nextPC += 4
+    emitter.load32(RAX, field(pcOffset));
+    emitter.store32(field(currentPCOffset), RAX);
+    emitter.load32(RAX, field(nextPCOffset));
+    emitter.store32(field(pcOffset), RAX);
+    emitter.alu32(Alu::Add, RAX, 4);
+    emitter.store32(field(nextPCOffset), RAX);
+
+    // delaySlot = branch; branchTakenDelaySlot = branchTaken; branch = branchTaken = false
+    emitter.load16(RAX, field(branchOffset), false);
+    emitter.shift32(Shift::Shl, RAX, 16);
+    emitter.store32(field(branchOffset), RAX);
+}
+
+void Recompiler::materializePC(Context& ctx) {
+    emitter.store32(field(currentPCOffset), ctx.address);
+    emitter.store32(field(pcOffset), ctx.address + 4);
+    emitter.store32(field(nextPCOffset), ctx.address + 8);
+    if (!ctx.flagsClean) {
+        emitter.store32(field(branchOffset), 0u);
+        ctx.flagsClean = true;
+    }
+}
+
+void Recompiler::flushCycles(Context& ctx) {
+    if (ctx.pendingCycles != 0) {
+        emitter.alu64(Alu::Add, field(cyclesOffset), static_cast<s32>(ctx.pendingCycles));
+        ctx.pendingCycles = 0;
+    }
+}
+
+void Recompiler::reconcileCycles(u32 pendingCycles) {
+    // The slow path already accounted the bus cycles, the common path adds the RAM access time after the join
+    emitter.alu64(Alu::Add, field(cyclesOffset), -static_cast<s32>(pendingCycles + Bus::CycleBias::RAM));
+}
+
+void Recompiler::resolveLoad(const Context& ctx, u32 dest) {
+    if (ctx.loadState != LoadState::Pending) return;
+
+    if (ctx.loadReg != 0 && ctx.loadReg != dest) {
+        emitter.load32(RDX, field(memoryLoadOffset + 4));
+        emitter.store32(gpr(ctx.loadReg), RDX);
+    }
+    if (dest == NO_REG) {
+        emitter.store64(field(memoryLoadOffset), 0);
+    }
+}
+
+void Recompiler::computeAddress(const Context& ctx) {
+    const Instruction instr{ctx.code};
+    loadReg(RCX, instr.rs);
+    if (instr.imm != 0) {
+        emitter.alu32(Alu::Add, RCX, static_cast<u32>(instr.immse));
+    }
+}
+
+void Recompiler::checkInterrupts() {
+    // The interrupt line is cached in the Cpu, only call out when an interrupt can actually be taken
+    auto& take = labels.emplace_back();
+    auto& done = labels.emplace_back();
+    emitter.cmp8(field(interruptOffset), 0);
+    emitter.jcc(Cond::NE, take);
+    emitter.bind(done);
+
+    farCode.emplace_back([this, &take, &done] {
+        emitter.bind(take);
+        callCpu(reinterpret_cast<const void*>(&Recompiler::takeInterrupt));
+        emitter.jmp(done);
+    });
+}
+
+Label& Recompiler::exitLabel(u32 cycles, const Context* materialize) {
+    auto& label = labels.emplace_back();
+    const bool dirty = materialize != nullptr && !materialize->dynamic;
+    const Context ctx = materialize != nullptr ? *materialize : Context{};
+
+    farCode.emplace_back([this, &label, cycles, dirty, ctx] {
+        emitter.bind(label);
+        if (dirty) {
+            Context copy = ctx;
+            materializePC(copy);
+        }
+        if (cycles != 0) {
+            emitter.alu64(Alu::Add, field(cyclesOffset), static_cast<s32>(cycles));
+        }
+        emitter.jmp(epilogue);
+    });
+    return label;
+}
+
+void Recompiler::addFastmemSite(Label& slow) {
+    // Emits the load of the window base, which must directly precede the access. The fault reports the address of the
+    // access, and the 10 byte base load is what gets patched into a jump
+    const auto patch = static_cast<size_t>(emitter.current() - codeBuffer);
+    emitter.mov64(RAX, reinterpret_cast<u64>(fastmemBase));
+    pendingSites.push_back({static_cast<size_t>(emitter.current() - codeBuffer), patch, &slow});
+}
+
+void Recompiler::loadReg(Reg dst, u32 reg) {
+    if (reg == 0) {
+        emitter.mov32(dst, 0u);
+    } else {
+        emitter.load32(dst, gpr(reg));
+    }
+}
+
+void Recompiler::callCpu(const void* function) {
+    emitter.mov64(ARG0, RBX);
+    emitter.call(function);
+}
+
+}  // namespace Cpu
@@ -0,0 +1,143 @@
+#pragma once
+#include <array>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cpu/cpu.hpp"
+#include "cpu/x64emitter.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RECOMPILER_X64 1
+#endif
+
+namespace Bus {
+class Bus;
+}
+
+namespace Cpu {
+
+// Translates blocks from the block cache into host code. Simple ALU ops and RAM accesses are emitted inline,
+// everything else calls the interpreter handler through a thunk so both backends share the same semantics.
+class Recompiler {
+  public:
+    using HostCode = void (*)(Cpu*);
+
+    Recompiler(Cpu& owner, Bus::Bus& memory);
+    ~Recompiler();
+
+    static constexpr bool isSupported() {
+#ifdef RECOMPILER_X64
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Returns nullptr on unsupported hosts or when the code buffer is full, check isFull() before compiling
+    HostCode compile(const Cpu::Block& block, u32 pc);
+    [[nodiscard]] bool isFull() const;
+    void reset();
+
+  private:
+    static constexpr size_t CODE_BUFFER_SIZE = 32_MB;
+    // Worst case host bytes per guest instruction, including its out of line paths
+    static constexpr size_t MAX_INSTRUCTION_SIZE = 384;
+
+    enum class LoadState { None, Pending, Unknown };
+
+    // Compile time view of the guest state while emitting a block
+    struct Context {
+        const Cpu::Block* block;
+        u32 address;
+        u32 code;
+        u32 cycles;
+        size_t index;
+        bool dynamic;  // PC/nextPC were advanced at runtime, the instruction is at block entry or in a delay slot
+        bool last;
+        u32 pendingCycles;
+        bool flagsClean;  // The branch/delay slot flags in memory are known to be clear
+        bool stateDirty;  // PC/nextPC/currentPC in memory lag behind inlined instructions
+        LoadState loadState;
+        u32 loadReg;
+    };
+
+    Cpu& cpu;
+    Bus::Bus& bus;
+
+    u8* codeBuffer = nullptr;
+    X64::Emitter emitter;
+    X64::Label epilogue;
+    std::deque<X64::Label> labels;
+    std::deque<std::function<void()>> farCode;
+
+    // With host fastmem, RAM accesses are a single host load or store into the guest window. The ones that fault (MMIO,
+    // scratchpad, BIOS writes, unmapped addresses) resume at the slow path of their instruction, keyed by host address.
+    // The load of the window base in front of the access is then patched into a jump to the slow path, so every site faults
+    // at most once
+    struct FastmemSite {
+        u8* patch;
+        u8* slow;
+    };
+    struct PendingSite {
+        size_t access;
+        size_t patch;
+        X64::Label* slow;
+    };
+    u8* fastmemBase = nullptr;
+    std::unordered_map<uintptr_t, FastmemSite> fastmemSites;
+    std::vector<PendingSite> pendingSites;
+
+    // Offsets of the Cpu members the generated code touches, relative to the Cpu pointer held in RBX
+    s32 gprOffset;
+    s32 statusOffset;
+    s32 pcOffset;
+    s32 nextPCOffset;
+    s32 currentPCOffset;
+    s32 branchOffset;
+    s32 instructionOffset;
+    s32 memoryLoadOffset;
+    s32 cyclesOffset;
+    s32 codePagesOffset;
+    s32 interruptOffset;
+
+    template <typename T>
+    s32 offsetOf(const T& member) const {
+        return static_cast<s32>(reinterpret_cast<const u8*>(&member) - reinterpret_cast<const u8*>(&cpu));
+    }
+
+    X64::Mem gpr(u32 reg) const { return {X64::RBX, gprOffset + static_cast<s32>(reg * 4)}; }
+    X64::Mem field(s32 offset) const { return {X64::RBX, offset}; }
+
+    // Entry points for generated code
+    template <Cpu::funcPtr handler>
+    static void interpret(Cpu* cpu);
+    template <const Cpu::funcPtr* table, size_t... I>
+    static constexpr std::array<HostCode, 64> makeThunks(std::index_sequence<I...>);
+    static void takeInterrupt(Cpu* cpu);
+    static void invalidateCode(Cpu* cpu, u32 address);
+    static bool handleFastmemFault(void* context, uintptr_t pc, uintptr_t& resume);
+
+    void compileInstruction(Context& ctx);
+    bool compileALU(Context& ctx);
+    bool compileLoad(Context& ctx);
+    bool compileStore(Context& ctx);
+    void compileFallback(Context& ctx);
+
+    void advancePC();
+    void materializePC(Context& ctx);
+    void flushCycles(Context& ctx);
+    void reconcileCycles(u32 pendingCycles);
+    void resolveLoad(const Context& ctx, u32 dest);
+    void computeAddress(const Context& ctx);
+    void checkInterrupts();
+    X64::Label& exitLabel(u32 cycles, const Context* materialize);
+
+    void addFastmemSite(X64::Label& slow);
+    void loadReg(X64::Reg dst, u32 reg);
+    void callCpu(const void* function);
+};
+
+}  // namespace Cpu
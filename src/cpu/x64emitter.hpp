@@ -0,0 +1,310 @@
+#pragma once
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "support/helpers.hpp"
+
+// Minimal x86-64 assembler, only covers the encodings the recompiler emits
+namespace Cpu::X64 {
+
+enum Reg : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+enum Cond : u8 { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G };
+
+// Group 1 opcodes, the /digit for the immediate forms and (digit << 3) | 1 for the register forms
+enum class Alu : u8 { Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7 };
+
+// Group 2 opcodes
+enum class Shift : u8 { Shl = 4, Shr = 5, Sar = 7 };
+
+#if defined(_WIN32)
+constexpr Reg ARG0 = RCX;
+constexpr Reg ARG1 = RDX;
+#else
+constexpr Reg ARG0 = RDI;
+constexpr Reg ARG1 = RSI;
+#endif
+
+// Memory operand, [base + index * scale + disp]
+struct Mem {
+    Reg base;
+    s32 disp = 0;
+    Reg index = RSP;  // RSP encodes "no index"
+    u8 scale = 1;
+};
+
+struct Label {
+    s64 position = -1;
+    std::vector<size_t> fixups;
+};
+
+class Emitter {
+  public:
+    void setBuffer(u8* buffer, size_t size) {
+        start = buffer;
+        end = buffer + size;
+        code = buffer;
+    }
+
+    void rewind() { code = start; }
+    [[nodiscard]] u8* current() const { return code; }
+    [[nodiscard]] size_t remaining() const { return static_cast<size_t>(end - code); }
+
+    void bind(Label& label) {
+        label.position = code - start;
+        for (const auto fixup : label.fixups) {
+            patchRel32(fixup, label.position);
+        }
+        label.fixups.clear();
+    }
+
+    void push(Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0x50 + (reg & 7));
+    }
+
+    void pop(Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0x58 + (reg & 7));
+    }
+
+    void ret() { emit8(0xC3); }
+
+    // mov r32, r32 / mov r64, r64
+    void mov32(Reg dst, Reg src) { opRR(false, 0x89, src, dst); }
+    void mov64(Reg dst, Reg src) { opRR(true, 0x89, src, dst); }
+
+    void mov32(Reg dst, u32 imm) {
+        if (imm == 0) {
+            alu32(Alu::Xor, dst, dst);
+            return;
+        }
+        rex(false, 0, 0, dst);
+        emit8(0xB8 + (dst & 7));
+        emit32(imm);
+    }
+
+    void mov64(Reg dst, u64 imm) {
+        rex(true, 0, 0, dst);
+        emit8(0xB8 + (dst & 7));
+        emit64(imm);
+    }
+
+    // Loads, zero/sign extended into a 32 bit register
+    void load8(Reg dst, const Mem& mem, bool sign) { opM(false, {0x0F, static_cast<u8>(sign ? 0xBE : 0xB6)}, dst, mem); }
+    void load16(Reg dst, const Mem& mem, bool sign) { opM(false, {0x0F, static_cast<u8>(sign ? 0xBF : 0xB7)}, dst, mem); }
+    void load32(Reg dst, const Mem& mem) { opM(false, {0x8B}, dst, mem); }
+    void load64(Reg dst, const Mem& mem) { opM(true, {0x8B}, dst, mem); }
+
+    void store8(const Mem& mem, Reg src) { opM(false, {0x88}, src, mem, true); }
+    void store16(const Mem& mem, Reg src) {
+        emit8(0x66);
+        opM(false, {0x89}, src, mem);
+    }
+    void store32(const Mem& mem, Reg src) { opM(false, {0x89}, src, mem); }
+    void store64(const Mem& mem, Reg src) { opM(true, {0x89}, src, mem); }
+
+    void store32(const Mem& mem, u32 imm) {
+        opM(false, {0xC7}, RAX, mem);
+        emit32(imm);
+    }
+
+    // Sign extended immediate
+    void store64(const Mem& mem, s32 imm) {
+        opM(true, {0xC7}, RAX, mem);
+        emit32(static_cast<u32>(imm));
+    }
+
+    void alu32(Alu op, Reg dst, Reg src) { opRR(false, (static_cast<u8>(op) << 3) | 1, src, dst); }
+    void alu64(Alu op, Reg dst, Reg src) { opRR(true, (static_cast<u8>(op) << 3) | 1, src, dst); }
+
+    void alu32(Alu op, Reg dst, u32 imm) {
+        const auto imm8 = static_cast<s32>(imm) >= -128 && static_cast<s32>(imm) <= 127;
+        rex(false, 0, 0, dst);
+        emit8(imm8 ? 0x83 : 0x81);
+        modrm(3, static_cast<u8>(op), dst);
+        if (imm8) {
+            emit8(static_cast<u8>(imm));
+        } else {
+            emit32(imm);
+        }
+    }
+
+    void alu64(Alu op, Reg dst, s32 imm) {
+        const auto imm8 = imm >= -128 && imm <= 127;
+        rex(true, 0, 0, dst);
+        emit8(imm8 ? 0x83 : 0x81);
+        modrm(3, static_cast<u8>(op), dst);
+        if (imm8) {
+            emit8(static_cast<u8>(imm));
+        } else {
+            emit32(static_cast<u32>(imm));
+        }
+    }
+
+    void alu32(Alu op, const Mem& mem, u32 imm) {
+        const auto imm8 = static_cast<s32>(imm) >= -128 && static_cast<s32>(imm) <= 127;
+        opM(false, {static_cast<u8>(imm8 ? 0x83 : 0x81)}, static_cast<Reg>(op), mem);
+        if (imm8) {
+            emit8(static_cast<u8>(imm));
+        } else {
+            emit32(imm);
+        }
+    }
+
+    void alu64(Alu op, const Mem& mem, s32 imm) {
+        const auto imm8 = imm >= -128 && imm <= 127;
+        opM(true, {static_cast<u8>(imm8 ? 0x83 : 0x81)}, static_cast<Reg>(op), mem);
+        if (imm8) {
+            emit8(static_cast<u8>(imm));
+        } else {
+            emit32(static_cast<u32>(imm));
+        }
+    }
+
+    void cmp8(const Mem& mem, u8 imm) {
+        opM(false, {0x80}, static_cast<Reg>(Alu::Cmp), mem);
+        emit8(imm);
+    }
+
+    void test32(Reg reg, u32 imm) {
+        rex(false, 0, 0, reg);
+        emit8(0xF7);
+        modrm(3, 0, reg);
+        emit32(imm);
+    }
+
+    void test32(const Mem& mem, u32 imm) {
+        opM(false, {0xF7}, RAX, mem);
+        emit32(imm);
+    }
+
+    void test64(Reg a, Reg b) { opRR(true, 0x85, b, a); }
+
+    void not32(Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0xF7);
+        modrm(3, 2, reg);
+    }
+
+    void shift32(Shift op, Reg reg, u8 amount) {
+        rex(false, 0, 0, reg);
+        emit8(0xC1);
+        modrm(3, static_cast<u8>(op), reg);
+        emit8(amount);
+    }
+
+    // Shift by CL
+    void shift32(Shift op, Reg reg) {
+        rex(false, 0, 0, reg);
+        emit8(0xD3);
+        modrm(3, static_cast<u8>(op), reg);
+    }
+
+    // setcc r8 for the legacy byte registers (AL, CL, DL, BL)
+    void setcc(Cond cond, Reg reg) {
+        assert(reg < RSP);
+        emit8(0x0F);
+        emit8(0x90 + cond);
+        modrm(3, 0, reg);
+    }
+
+    void call(const void* target) {
+        mov64(RAX, reinterpret_cast<u64>(target));
+        emit8(0xFF);
+        modrm(3, 2, RAX);
+    }
+
+    void jmp(Label& label) {
+        emit8(0xE9);
+        jumpTo(label);
+    }
+
+    // Overwrites already emitted code at `site` with a jump to `target`, the instruction there has to be 5 bytes or longer
+    static void patchJump(u8* site, const u8* target) {
+        const s32 rel = static_cast<s32>(target - (site + 5));
+        std::memcpy(site + 1, &rel, sizeof(rel));
+        site[0] = 0xE9;
+    }
+
+    void jcc(Cond cond, Label& label) {
+        emit8(0x0F);
+        emit8(0x80 + cond);
+        jumpTo(label);
+    }
+
+  private:
+    u8* start = nullptr;
+    u8* end = nullptr;
+    u8* code = nullptr;
+
+    void emit8(u8 value) { *code++ = value; }
+    void emit32(u32 value) {
+        std::memcpy(code, &value, sizeof(value));
+        code += sizeof(value);
+    }
+    void emit64(u64 value) {
+        std::memcpy(code, &value, sizeof(value));
+        code += sizeof(value);
+    }
+
+    void modrm(u8 mod, u8 reg, u8 rm) { emit8((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    // byteReg forces a REX prefix so SPL/BPL/SIL/DIL are encoded instead of AH/CH/DH/BH
+    void rex(bool w, u8 reg, u8 index, u8 base, bool byteReg = false) {
+        const u8 value = (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (value != 0 || (byteReg && reg >= RSP)) {
+            emit8(0x40 | value);
+        }
+    }
+
+    void opRR(bool w, u8 opcode, Reg reg, Reg rm) {
+        rex(w, reg, 0, rm);
+        emit8(opcode);
+        modrm(3, reg, rm);
+    }
+
+    void opM(bool w, std::initializer_list<u8> opcode, Reg reg, const Mem& mem, bool byteReg = false) {
+        rex(w, reg, mem.index, mem.base, byteReg);
+        for (const auto byte : opcode) {
+            emit8(byte);
+        }
+
+        const bool disp8 = mem.disp >= -128 && mem.disp <= 127;
+        // RBP and R13 have no displacement free encoding
+        const u8 mod = (mem.disp == 0 && (mem.base & 7) != RBP) ? 0 : (disp8 ? 1 : 2);
+
+        if (mem.index != RSP || (mem.base & 7) == RSP) {
+            const u8 scale = mem.scale == 8 ? 3 : mem.scale == 4 ? 2 : mem.scale == 2 ? 1 : 0;
+            modrm(mod, reg, RSP);
+            emit8((scale << 6) | ((mem.index & 7) << 3) | (mem.base & 7));
+        } else {
+            modrm(mod, reg, mem.base);
+        }
+
+        if (mod == 1) {
+            emit8(static_cast<u8>(mem.disp));
+        } else if (mod == 2) {
+            emit32(static_cast<u32>(mem.disp));
+        }
+    }
+
+    void jumpTo(Label& label) {
+        const auto position = static_cast<size_t>(code - start);
+        emit32(0);
+        if (label.position >= 0) {
+            patchRel32(position, label.position);
+        } else {
+            label.fixups.push_back(position);
+        }
+    }
+
+    void patchRel32(size_t position, s64 target) {
+        const s32 rel = static_cast<s32>(target - static_cast<s64>(position + 4));
+        std::memcpy(start + position, &rel, sizeof(rel));
+    }
+};
+
+}  // namespace Cpu::X64
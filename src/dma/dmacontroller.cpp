@@ -12,7 +12,10 @@
 
 namespace DMA {
 
-DMA::DMA(Bus::Bus& bus, Scheduler::Scheduler& scheduler) : bus(bus), scheduler(scheduler) { reset(); }
+DMA::DMA(Bus::Bus& bus, Scheduler::Scheduler& scheduler) : bus(bus), scheduler(scheduler) {
+    scheduler.registerEvent(Scheduler::Event::DMAInterrupt, [this]() { this->bus.triggerInterrupt(Bus::IRQ::DMA); });
+    reset();
+}
 
 void DMA::reset() {
     dpcr = 0x07654321;
@@ -118,8 +121,9 @@ void DMA::checkIRQ() {
 
     dicr.masterIRQFlag = dicr.forceIRQ || (dicr.masterIRQEnable && (dicr.im & dicr.ip));
 
-    if (!prevMIF && dicr.masterIRQFlag) {
-        scheduler.scheduleInterrupt(1000, Bus::IRQ::DMA);
+    // An already pending interrupt fires first and covers this edge as well
+    if (!prevMIF && dicr.masterIRQFlag && !scheduler.isScheduled(Scheduler::Event::DMAInterrupt)) {
+        scheduler.schedule(Scheduler::Event::DMAInterrupt, 1000);
     }
 }
 
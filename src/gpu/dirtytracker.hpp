@@ -0,0 +1,80 @@
+#pragma once
+#include <algorithm>
+#include <bitset>
+
+#include "gpu.hpp"
+
+namespace GPU {
+
+// Coarse record of the VRAM areas written since a consumer last caught up with them, one bit per 64x64 tile
+class DirtyTracker {
+  public:
+    static constexpr int TILE_SIZE = 64;
+    static constexpr int TILES_X = GPU::VRAM_WIDTH / TILE_SIZE;
+    static constexpr int TILES_Y = GPU::VRAM_HEIGHT / TILE_SIZE;
+
+    using Mask = std::bitset<TILES_X * TILES_Y>;
+
+    // Tiles touched by a rectangle, which wraps around the VRAM edges the same way texture and transfer addressing does
+    static Mask tilesOf(int x, int y, int width, int height) {
+        Mask mask;
+        if (width <= 0 || height <= 0) return mask;
+
+        x &= GPU::VRAM_WIDTH - 1;
+        y &= GPU::VRAM_HEIGHT - 1;
+        const int columns = std::min((x % TILE_SIZE + width + TILE_SIZE - 1) / TILE_SIZE, TILES_X);
+        const int rows = std::min((y % TILE_SIZE + height + TILE_SIZE - 1) / TILE_SIZE, TILES_Y);
+        for (int row = 0; row < rows; row++) {
+            const int tileY = (y / TILE_SIZE + row) % TILES_Y;
+            for (int column = 0; column < columns; column++) {
+                mask.set(static_cast<size_t>(tileY * TILES_X + (x / TILE_SIZE + column) % TILES_X));
+            }
+        }
+        return mask;
+    }
+
+    // Texels a textured primitive may sample, the whole texture page plus its CLUT for the palettized depths
+    static Mask textureTiles(u16 texpage, u16 clut) {
+        const int depth = (texpage >> 7) & 3;
+        const int pageX = (texpage & 0xF) * 64;
+        const int pageY = ((texpage >> 4) & 1) * 256;
+
+        if (depth >= 2) return tilesOf(pageX, pageY, 256, 256);
+        return tilesOf(pageX, pageY, depth == 0 ? 64 : 128, 256) | tilesOf((clut & 0x3F) * 16, (clut >> 6) & 0x1FF, depth == 0 ? 16 : 256, 1);
+    }
+
+    void mark(int x, int y, int width, int height) { dirty |= tilesOf(x, y, width, height); }
+    void mark(const Mask& tiles) { dirty |= tiles; }
+    void markAll() { dirty.set(); }
+
+    // Returns the dirty tiles within `tiles` and considers them clean from now on
+    Mask take(const Mask& tiles) {
+        const auto taken = dirty & tiles;
+        dirty &= ~tiles;
+        return taken;
+    }
+
+    [[nodiscard]] bool any(const Mask& tiles) const { return (dirty & tiles).any(); }
+
+    // Calls func(x, y, width, height) in pixels for every horizontal run of set tiles
+    template <typename Func>
+    static void forEachRun(const Mask& tiles, Func&& func) {
+        for (int row = 0; row < TILES_Y; row++) {
+            for (int column = 0; column < TILES_X;) {
+                if (!tiles[static_cast<size_t>(row * TILES_X + column)]) {
+                    column++;
+                    continue;
+                }
+
+                const int start = column;
+                while (column < TILES_X && tiles[static_cast<size_t>(row * TILES_X + column)]) column++;
+                func(start * TILE_SIZE, row * TILE_SIZE, (column - start) * TILE_SIZE, TILE_SIZE);
+            }
+        }
+    }
+
+  private:
+    Mask dirty;
+};
+
+}  // namespace GPU
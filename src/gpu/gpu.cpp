@@ -4,7 +4,9 @@
 
 namespace GPU {
 
-GPU::GPU(Scheduler::Scheduler& scheduler) : scheduler(scheduler) {}
+GPU::GPU(Scheduler::Scheduler& scheduler) : scheduler(scheduler) {
+    scheduler.registerEvent(Scheduler::Event::VBlank, [this]() { vblankEvent(); });
+}
 
 GPU::~GPU() {}
 
@@ -26,6 +28,9 @@ void GPU::reset() {
     drawArea = {0, 0, 0, 0};
     drawOffset.x() = 0;
     drawOffset.y() = 0;
+    texWindow = {0, 0, 0, 0};
+    displayStart.x() = 0;
+    displayStart.y() = 0;
     transferRect = {0, 0, 0, 0};
     transferSize = 0;
     transferIndex = 0;
@@ -57,15 +62,62 @@ void GPU::reset() {
     semiTrans = 0;
     textureDepth = static_cast<TextureDepth>(0);
     displayDepth = static_cast<DisplayDepth>(0);
+
+    frameReady = false;
+    frameStart = scheduler.cycles();
+    currentLine = 0;
+    scheduleVBlank();
+}
+
+DisplayArea GPU::getDisplayArea() const {
+    static constexpr u16 widths[4] = {256, 320, 512, 640};
+    const u16 width = (hres & 1) ? 368 : widths[hres >> 1];
+    const u16 height = interlaced && vres == V480 ? 480 : 240;
+    auto start = displayStart;
+    return {start.x(), start.y(), width, height, displayDepth != D15};
+}
+
+void GPU::sync() {
+    const auto frameCycles = toCpuCycles(u64(cyclesPerScanline()) * scanlinesPerFrame());
+    const auto elapsed = scheduler.cycles() - frameStart;
+    if (elapsed >= frameCycles) {
+        const auto frames = elapsed / frameCycles;
+        frameStart += frames * frameCycles;
+        if (frames & 1) interlaceField = !interlaceField;
+    }
+
+    const auto dot = (scheduler.cycles() - frameStart) * GPU_CLOCK_NUM / GPU_CLOCK_DEN;
+    currentLine = static_cast<u32>(dot / cyclesPerScanline());
+    inHblank = dot % cyclesPerScanline() >= CYCLES_PER_HDRAW;
+    inVblank = currentLine >= scanlinesPerVDraw();
+}
+
+void GPU::scheduleVBlank() {
+    sync();
+    auto target = frameStart + toCpuCycles(u64(cyclesPerScanline()) * scanlinesPerVDraw());
+    if (target <= scheduler.cycles()) target += toCpuCycles(u64(cyclesPerScanline()) * scanlinesPerFrame());
+    scheduler.scheduleAt(Scheduler::Event::VBlank, target);
+}
+
+void GPU::vblankEvent() {
+    scheduler.bus.triggerInterrupt(Bus::IRQ::VBLANK);
+    frameReady = true;
+    scheduleVBlank();
 }
 
 u32 GPU::read1() {
     //    return gpustat;
-    return 0b01011110100000000000000000000000;
+    sync();
+
+    // Bit 31 alternates per scanline, or per field in 480i, and reads 0 during vblank
+    const bool oddLine = interlaced && vres == V480 ? interlaceField : (currentLine & 1);
+    const u32 status = 0b01011110100000000000000000000000;
+    return status | (static_cast<u32>(oddLine && !inVblank) << 31);
 }
 
 u32 GPU::read0() {
     if (readMode == Transfer) {
+        if (transferIndex == 0) finishTransferToCpu();
         auto value = transferReadBuffer[transferIndex++];
         if (transferSize-- == 0) {
             readMode = Command;
@@ -130,7 +182,9 @@ void GPU::write1(u32 value) {
         case 0x7: setDisplayVerticalRange(value); break;
         // Display Mode
         case 0x8:
+            sync();
             setDisplayMode(value);
+            scheduleVBlank();
             break;
             // GPU Info
         case 0x10: setGPUInfo(value); break;
@@ -40,6 +40,15 @@ struct TextureWindow {
     u16 yMask;
 };
 
+// The part of VRAM currently scanned out to the TV
+struct DisplayArea {
+    u16 x;
+    u16 y;
+    u16 width;
+    u16 height;
+    bool is24Bit;
+};
+
 struct Point {
     u32 pos;
     u32 color;
@@ -61,6 +70,33 @@ class GPU {
     void write0(u32 value);
     void write1(u32 value);
 
+    // Called by the frontend once an emulated frame is complete
+    virtual void vblank() {}
+
+    // Waits for any queued rendering to reach vram
+    virtual void flush() {}
+
+    // Backends that render on the host GPU only keep this copy in sync for CPU readbacks
+    [[nodiscard]] const std::vector<u16>& getVRAM() const { return vram; }
+    [[nodiscard]] DisplayArea getDisplayArea() const;
+
+    // Video timing is derived from the CPU cycle counter on demand, only the start of vblank is a scheduler event
+    void sync();
+
+    // Set when the display enters vblank, the frontend clears it after presenting the frame
+    bool frameReady = false;
+
+    // Timings in GPU clock cycles, the GPU runs at 11/7 of the CPU clock
+    static constexpr u32 GPU_CLOCK_NUM = 11;
+    static constexpr u32 GPU_CLOCK_DEN = 7;
+    static constexpr u32 CYCLES_PER_HDRAW = 2560;
+    static constexpr u32 CYCLES_PER_SCANLINE_NTSC = 3413;
+    static constexpr u32 CYCLES_PER_SCANLINE_PAL = 3406;
+    static constexpr u32 SCANLINES_PER_FRAME_NTSC = 263;
+    static constexpr u32 SCANLINES_PER_FRAME_PAL = 314;
+    static constexpr u32 SCANLINES_PER_VDRAW_NTSC = 240;
+    static constexpr u32 SCANLINES_PER_VDRAW_PAL = 288;
+
     static constexpr int VRAM_WIDTH = 1024;
     static constexpr int VRAM_HEIGHT = 512;
     static constexpr int VRAM_SIZE = VRAM_WIDTH * VRAM_HEIGHT;
@@ -84,6 +120,8 @@ class GPU {
     virtual void drawCommand() = 0;
     virtual void transferToVram() = 0;
     virtual void transferToCpu() = 0;
+    // Called before the first word of a VRAM->CPU transfer is read, for backends that fill transferReadBuffer asynchronously
+    virtual void finishTransferToCpu() {}
     virtual void TransferVramToVram() = 0;
     virtual void internalCommand(u32 value) = 0;
 
@@ -105,6 +143,15 @@ class GPU {
     void setDisplayMode(u32 value);
     void setGPUInfo(u32 value);
 
+    [[nodiscard]] u32 cyclesPerScanline() const { return videoMode == PAL ? CYCLES_PER_SCANLINE_PAL : CYCLES_PER_SCANLINE_NTSC; }
+    [[nodiscard]] u32 scanlinesPerFrame() const { return videoMode == PAL ? SCANLINES_PER_FRAME_PAL : SCANLINES_PER_FRAME_NTSC; }
+    [[nodiscard]] u32 scanlinesPerVDraw() const { return videoMode == PAL ? SCANLINES_PER_VDRAW_PAL : SCANLINES_PER_VDRAW_NTSC; }
+    // Converts a GPU cycle count into the CPU cycles needed to reach it
+    static u64 toCpuCycles(u64 gpuCycles) { return (gpuCycles * GPU_CLOCK_DEN + GPU_CLOCK_NUM - 1) / GPU_CLOCK_NUM; }
+
+    void scheduleVBlank();
+    void vblankEvent();
+
     u16 drawMode;
     u8 texPageX;
     u8 texPageY;
@@ -129,8 +176,8 @@ class GPU {
 
     u32 dmaRequest;
 
-    u64 cycles = 0;
-    u64 lines = 0;
+    u64 frameStart = 0;  // CPU cycle at which scanline 0 of the current frame began
+    u32 currentLine = 0;
 
     DmaDirection dmaDirection;
     OpenGL::Vector<u16, 2> displayStart;
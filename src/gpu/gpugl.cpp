@@ -1,6 +1,7 @@
 #include "gpugl.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <utility>
 
 #include "scheduler/scheduler.hpp"
@@ -14,22 +15,37 @@ static const char* vertShader = R"(
     layout (location = 3) in int inClut;
     layout (location = 2) in int inTexpage;
     layout (location = 4) in ivec2 inUV;
+    layout (location = 5) in uint inTexWindow;
+    layout (location = 6) in uint inBlendMode;
+    layout (location = 7) in uint inTextureSlot;
 
     out vec4 vertexColor;
     out vec2 texCoords;
-    flat out ivec2 clutBase;
+    flat out ivec2 decodedBase;
     flat out ivec2 texpageBase;
     flat out int texMode;
-
-    // We always apply a 0.5 offset in addition to the drawing offsets, to cover up OpenGL inaccuracies
-    uniform vec2 u_drawOffsets = vec2(+0.5, -0.5);
+    flat out ivec4 texWindow;
+    flat out vec4 blendFactors;
+    flat out vec4 opaqueBlendFactors;
+    flat out float forcedMask;
+
+    // 0 for regular batches, 1 and 2 for the additive and subtractive passes of blend mode 2 batches
+    uniform int u_blendPass = 0;
+    uniform int u_resolutionScale = 1;
+
+    // Dual-source blend coefficients (source in rgb, destination in alpha) per semi-transparency mode, opaque is index 4
+    const vec4 additiveFactors[5] = vec4[5](
+        vec4(0.5, 0.5, 0.5, 0.5), vec4(1.0, 1.0, 1.0, 1.0), vec4(0.0, 0.0, 0.0, 1.0), vec4(0.25, 0.25, 0.25, 1.0), vec4(1.0, 1.0, 1.0, 0.0)
+    );
 
     void main() {
         // Normalize coords to [0, 2]
+        // Positions already include the drawing offset, we always apply half a framebuffer pixel on top to cover up OpenGL inaccuracies
+        vec2 pixelOffset = vec2(0.5, -0.5) / float(u_resolutionScale);
         float x = float(inPos.x);
         float y = float(inPos.y);
-        float xx = (x + u_drawOffsets.x) / 512.0;
-        float yy = (y + u_drawOffsets.y) / 256;
+        float xx = (x + pixelOffset.x) / 512.0;
+        float yy = (y + pixelOffset.y) / 256;
 
         // Normalize to [-1, 1]
         xx -= 1.0;
@@ -43,13 +59,31 @@ static const char* vertShader = R"(
         gl_Position = vec4(xx, yy, 1.0, 1.0);
         vertexColor = vec4(color / 255.0, 1.0);
 
+        // Texture window format
+        // x, y components: masks to & coords with
+        // z, w components: masks to | coords with
+        ivec2 windowMask = ivec2(inTexWindow & 0x1fu, (inTexWindow >> 5u) & 0x1fu) * 8;
+        ivec2 windowOffset = ivec2((inTexWindow >> 10u) & 0x1fu, (inTexWindow >> 15u) & 0x1fu) * 8;
+        texWindow = ivec4(~windowMask, windowOffset & windowMask);
+
+        uint blendMode = inBlendMode & 7u;
+        if (u_blendPass == 2) { // Second pass of mode 2 subtracts, everything else has to leave the first pass result alone
+            blendFactors = blendMode == 2u ? vec4(1.0, 1.0, 1.0, 1.0) : vec4(0.0, 0.0, 0.0, 1.0);
+            opaqueBlendFactors = vec4(0.0, 0.0, 0.0, 1.0);
+        } else {
+            blendFactors = additiveFactors[blendMode];
+            opaqueBlendFactors = additiveFactors[4];
+        }
+        // GP0(E6h) bit 0, written pixels get the mask bit whatever their colour
+        forcedMask = float((inBlendMode >> 3u) & 1u);
+
         if ((inTexpage & 0x8000) != 0) { // Untextured primitive
             texMode = 4;
         } else {
             texMode = (inTexpage >> 7) & 3;
             texCoords = inUV;
             texpageBase = ivec2((inTexpage & 0xf) * 64, ((inTexpage >> 4) & 0x1) * 256);
-            clutBase = ivec2((inClut & 0x3f) * 16, inClut >> 6);
+            decodedBase = ivec2(inTextureSlot % 8u, inTextureSlot / 8u) * 256;
         }
 }
 
@@ -60,40 +94,33 @@ static const char* fragShader = R"(
 
      in vec4 vertexColor;
      in vec2 texCoords;
-     flat in ivec2 clutBase;
+     flat in ivec2 decodedBase;
      flat in ivec2 texpageBase;
      flat in int texMode;
+     flat in ivec4 texWindow;
+     flat in vec4 blendFactors;
+     flat in vec4 opaqueBlendFactors;
+     flat in float forcedMask;
 
      // We use dual-source blending in order to emulate the fact that the GPU can enable blending per-pixel
-     // FragColor: The colour of the pixel before alpha blending comes into play
+     // FragColor: The colour of the pixel before alpha blending comes into play, alpha carries the mask bit
      // BlendColor: Contains blending coefficients
      layout(location = 0, index = 0) out vec4 FragColor;
      layout(location = 0, index = 1) out vec4 BlendColor;
 
-     // Tex window uniform format
-     // x, y components: masks to & coords with
-     // z, w components: masks to | coords with
-     uniform ivec4 u_texWindow;
-     uniform sampler2D u_sampleTex;
-     uniform vec4 u_blendFactors;
-     uniform vec4 u_opaqueBlendFactors = vec4(1.0, 1.0, 1.0, 0.0);
+     // Both hold raw PSX pixel words, mask bit included
+     uniform usampler2D u_sampleTex;
+     uniform usampler2D u_decodedTex;
+     uniform int u_resolutionScale = 1;
 
-     int floatToU5(float f) {
-         return int(floor(f * 31.0 + 0.5));
-     }
-
-     vec4 sampleVRAM(ivec2 coords) {
+     uint sampleVRAM(ivec2 coords) {
          coords &= ivec2(1023, 511); // Out-of-bounds VRAM accesses wrap
-         return texelFetch(u_sampleTex, coords, 0);
+         return texelFetch(u_sampleTex, coords * u_resolutionScale, 0).r;
      }
 
-     int sample16(ivec2 coords) {
-         vec4 colour = sampleVRAM(coords);
-         int r = floatToU5(colour.r);
-         int g = floatToU5(colour.g);
-         int b = floatToU5(colour.b);
-         int msb = int(ceil(colour.a)) << 15;
-         return r | (g << 5) | (b << 10) | msb;
+     vec4 wordToColour(uint word) {
+         vec3 rgb = vec3(uvec3(word, word >> 5u, word >> 10u) & 0x1fu) / 31.0;
+         return vec4(rgb, float(word >> 15u));
      }
 
      // Apply texture blending
@@ -106,88 +133,136 @@ static const char* fragShader = R"(
 
      void main() {
         if (texMode == 4) { // Untextured primitive
-            FragColor = vertexColor;
-            BlendColor = u_blendFactors;
+            FragColor = vec4(vertexColor.rgb, forcedMask);
+            BlendColor = blendFactors;
             return;
         }
 
         // Fix up UVs and apply texture window
         ivec2 UV = ivec2(floor(texCoords + vec2(0.0001, 0.0001))) & ivec2(0xff);
-        UV = (UV & u_texWindow.xy) | u_texWindow.zw;
+        UV = (UV & texWindow.xy) | texWindow.zw;
 
-        if (texMode == 0) { // 4bpp texture
-            ivec2 texelCoord = ivec2(UV.x >> 2, UV.y) + texpageBase;
+        uint texel;
+        if (texMode < 2) { // 4bpp and 8bpp textures come already run through their CLUT from the texture cache
+            texel = texelFetch(u_decodedTex, decodedBase + UV, 0).r;
+        } else { // Texture depth 2 and 3 both indicate 16bpp textures
+            texel = sampleVRAM(UV + texpageBase);
+        }
 
-            int samp = sample16(texelCoord);
-            int shift = (UV.x & 3) << 2;
-            int clutIndex = (samp >> shift) & 0xf;
+        // Only an all zero word is transparent, black with the mask bit set is drawn. The mask bit selects semi-transparency
+        if (texel == 0u) discard;
+        BlendColor = (texel & 0x8000u) != 0u ? blendFactors : opaqueBlendFactors;
+        FragColor = vec4(texBlend(wordToColour(texel), vertexColor).rgb, max(float(texel >> 15u), forcedMask));
+     }
+)";
 
-            ivec2 sampCoords = ivec2(clutBase.x + clutIndex, clutBase.y);
-            FragColor = texelFetch(u_sampleTex, sampCoords, 0);
+// A triangle strip of 4 vertices covering the viewport, for the passes that work on whole VRAM areas
+static const char* quadVertShader = R"(
+    #version 410 core
 
-            if (FragColor.rgb == vec3(0.0, 0.0, 0.0)) discard;
-            BlendColor = FragColor.a >= 0.5 ? u_blendFactors : u_opaqueBlendFactors;
-            FragColor = texBlend(FragColor, vertexColor);
-        } else if (texMode == 1) { // 8bpp texture
-            ivec2 texelCoord = ivec2(UV.x >> 1, UV.y) + texpageBase;
+    void main() {
+        vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+    }
+)";
 
-            int samp = sample16(texelCoord);
-            int shift = (UV.x & 1) << 3;
-            int clutIndex = (samp >> shift) & 0xff;
+// Runs a 4bpp or 8bpp texture page through its CLUT into a 256x256 texture cache slot
+static const char* decodeFragShader = R"(
+    #version 410 core
 
-            ivec2 sampCoords = ivec2(clutBase.x + clutIndex, clutBase.y);
-            FragColor = texelFetch(u_sampleTex, sampCoords, 0);
+    out uint FragWord;
 
-            if (FragColor.rgb == vec3(0.0, 0.0, 0.0)) discard;
-            BlendColor = FragColor.a >= 0.5 ? u_blendFactors : u_opaqueBlendFactors;
-            FragColor = texBlend(FragColor, vertexColor);
-        } else { // Texture depth 2 and 3 both indicate 16bpp textures
-            ivec2 texelCoord = UV + texpageBase;
-            FragColor = sampleVRAM(texelCoord);
+    uniform usampler2D u_sampleTex;
+    uniform int u_texpage;
+    uniform int u_clut;
+    uniform int u_resolutionScale = 1;
 
-            if (FragColor.rgb == vec3(0.0, 0.0, 0.0)) discard;
-            FragColor = texBlend(FragColor, vertexColor);
-            BlendColor = u_blendFactors;
+    uint sampleVRAM(ivec2 coords) {
+        coords &= ivec2(1023, 511); // Out-of-bounds VRAM accesses wrap
+        return texelFetch(u_sampleTex, coords * u_resolutionScale, 0).r;
+    }
+
+    void main() {
+        // Slots are aligned to 256 texels, so the texel position within the slot is the UV
+        ivec2 UV = ivec2(gl_FragCoord.xy) & ivec2(0xff);
+        ivec2 texpageBase = ivec2((u_texpage & 0xf) * 64, ((u_texpage >> 4) & 0x1) * 256);
+        ivec2 clutBase = ivec2((u_clut & 0x3f) * 16, u_clut >> 6);
+
+        int clutIndex;
+        if (((u_texpage >> 7) & 3) == 0) {
+            int samp = int(sampleVRAM(ivec2(UV.x >> 2, UV.y) + texpageBase));
+            clutIndex = (samp >> ((UV.x & 3) << 2)) & 0xf;
+        } else {
+            int samp = int(sampleVRAM(ivec2(UV.x >> 1, UV.y) + texpageBase));
+            clutIndex = (samp >> ((UV.x & 1) << 3)) & 0xff;
         }
-     }
+        FragWord = sampleVRAM(ivec2(clutBase.x + clutIndex, clutBase.y));
+    }
 )";
 
-GPU_GL::GPU_GL(Scheduler::Scheduler& scheduler) : GPU(scheduler) {}
+// Packs the rendered RGBA8 VRAM back into raw pixel words for sampleTex, one framebuffer pixel per texel
+static const char* packFragShader = R"(
+    #version 410 core
+
+    out uint FragWord;
+
+    uniform sampler2D u_vramTex;
 
-GPU_GL::~GPU_GL() {}
+    uint floatToU5(float f) {
+        return uint(floor(f * 31.0 + 0.5));
+    }
+
+    void main() {
+        vec4 colour = texelFetch(u_vramTex, ivec2(gl_FragCoord.xy), 0);
+        uint mask = colour.a >= 0.5 ? 0x8000u : 0u;
+        FragWord = floatToU5(colour.r) | (floatToU5(colour.g) << 5u) | (floatToU5(colour.b) << 10u) | mask;
+    }
+)";
+
+GPU_GL::GPU_GL(Scheduler::Scheduler& events, int scale) : GPU(events), resolutionScale(std::clamp(scale, 1, maxResolutionScale)) {}
+
+GPU_GL::~GPU_GL() {
+    if (readbackFence) glDeleteSync(readbackFence);
+}
 
 void GPU_GL::reset() {
     GPU::reset();
-    verts.clear();
-    verts.resize(vboSize);
-    vertCount = 0;
+    // Queued vertices are dropped, the part of the segment in flight stays untouched
+    vertCount = batchStart;
+    batchBounds = emptyBounds;
+    writeTilesBounds = emptyBounds;
+    writeTiles.reset();
+    batchReads.reset();
+    pendingUploads.clear();
+    uploadStaging.clear();
+    uploadTiles.reset();
+    sampleDirty.markAll();
+    textureCache.clear();
+    batchSlots.reset();
     drawArea.left = 0;
     drawArea.top = 0;
     drawArea.right = VRAM_WIDTH;
     drawArea.bottom = VRAM_HEIGHT;
     updateDrawAreaScissor();
 
-    //    scheduler.scheduleEvent(CYCLES_PER_HDRAW, [&]{
-    //        hblankEvent();
-    //    });
-    //
-    //    scheduler.scheduleEvent(CYCLES_PER_SCANLINE, [&]{
-    //        scanlineEvent();
-    //    });
-
     shaders.use();
     uniformTextureLocation = shaders.getUniformLocation("u_sampleTex");
-    uniformTextureWindow = shaders.getUniformLocation("u_texWindow");
-    uniformDrawOffsetLocation = shaders.getUniformLocation("u_drawOffsets");
-    uniformBlendFactors = shaders.getUniformLocation("u_blendFactors");
-    uniformOpaqueBlendFactors = shaders.getUniformLocation("u_opaqueBlendFactors");
-
-    inVblank = false;
-    lineCount = 0;
+    uniformBlendPass = shaders.getUniformLocation("u_blendPass");
+    uniformResolutionScale = shaders.getUniformLocation("u_resolutionScale");
+    uniformDecodedTex = shaders.getUniformLocation("u_decodedTex");
+
+    decodeShaders.use();
+    glUniform1i(decodeShaders.getUniformLocation("u_sampleTex"), 0);
+    glUniform1i(decodeShaders.getUniformLocation("u_resolutionScale"), resolutionScale);
+    uniformDecodeTexpage = decodeShaders.getUniformLocation("u_texpage");
+    uniformDecodeClut = decodeShaders.getUniformLocation("u_clut");
+
+    packShaders.use();
+    glUniform1i(packShaders.getUniformLocation("u_vramTex"), 2);
+    shaders.use();
 
-    lastBlendMode = -1;
-    lastTransparency = Transparency::Opaque;
-    setBlendFactors(0.0f, 0.0f);
+    blendMode = opaqueBlendMode;
+    batchSubtractive = false;
     setDisplayEnable(false);
     setTextureWindow(0);
     setDrawOffset(0);
@@ -195,11 +270,13 @@ void GPU_GL::reset() {
 
 void GPU_GL::init() {
     shaders.build(vertShader, fragShader);
+    decodeShaders.build(quadVertShader, decodeFragShader);
+    packShaders.build(quadVertShader, packFragShader);
 
     vramFBO.create();
     vramFBO.bind();
 
-    vramTex.create(GL_RGBA8, VRAM_WIDTH, VRAM_HEIGHT);
+    vramTex.create(GL_RGBA8, VRAM_WIDTH * resolutionScale, VRAM_HEIGHT * resolutionScale);
     vramTex.setFiltering(OpenGL::Linear);
     vramFBO.attachTexture(vramTex.handle());
 
@@ -216,11 +293,53 @@ void GPU_GL::init() {
     OpenGL::setClearColor();
     OpenGL::clearColor();
 
-    sampleTex.create(GL_RGBA8, VRAM_WIDTH, VRAM_HEIGHT);
-    sampleTex.setFiltering(OpenGL::Linear);
+    // Raw 16-bit pixel words, integer textures cannot be filtered
+    sampleFBO.create();
+    sampleFBO.bind();
+    sampleTex.create(GL_R16UI, VRAM_WIDTH * resolutionScale, VRAM_HEIGHT * resolutionScale);
+    sampleTex.setFiltering(OpenGL::Nearest);
+    sampleFBO.attachTexture(sampleTex.handle());
+    OpenGL::checkFramebufferStatus();
+
+    // Uploads and readbacks stay at native resolution, they go through these textures and get scaled with a blit
+    if (resolutionScale > 1) {
+        nativeFBO.create();
+        nativeFBO.bind();
+        nativeTex.create(GL_RGBA8, VRAM_WIDTH, VRAM_HEIGHT);
+        nativeTex.setFiltering(OpenGL::Nearest);
+        nativeFBO.attachTexture(nativeTex.handle());
+        OpenGL::checkFramebufferStatus();
+
+        nativeSampleFBO.create();
+        nativeSampleFBO.bind();
+        nativeSampleTex.create(GL_R16UI, VRAM_WIDTH, VRAM_HEIGHT);
+        nativeSampleTex.setFiltering(OpenGL::Nearest);
+        nativeSampleFBO.attachTexture(nativeSampleTex.handle());
+        OpenGL::checkFramebufferStatus();
+    }
+
+    static_assert(atlasSlotsX * atlasSlotsX == TextureCache::SLOTS);
+    decodeFBO.create();
+    decodeFBO.bind();
+    decodedTex.create(GL_R16UI, atlasSlotsX * TextureCache::PAGE_SIZE, atlasSlotsX * TextureCache::PAGE_SIZE);
+    decodedTex.setFiltering(OpenGL::Nearest);
+    decodeFBO.attachTexture(decodedTex.handle());
+    OpenGL::checkFramebufferStatus();
 
     vao.create();
-    vbo.createFixed(OpenGL::ArrayBuffer, vboSize, OpenGL::StreamDraw);
+    if (vbo.createPersistent(OpenGL::ArrayBuffer, vboSegmentVerts * sizeof(Vertex), vboSegments)) {
+        verts = vbo.segmentData<Vertex>();
+    } else {
+        vbo.createFixed(OpenGL::ArrayBuffer, vboSegmentVerts * sizeof(Vertex), OpenGL::StreamDraw);
+        fallbackVerts.resize(vboSegmentVerts);
+        verts = fallbackVerts.data();
+    }
+
+    readbackPBO.createFixed(OpenGL::PixelPackBuffer, VRAM_SIZE * sizeof(u16), OpenGL::StreamRead);
+    readbackPBO.unbind();
+    uploadPBO.createFixed(OpenGL::PixelUnpackBuffer, VRAM_SIZE * sizeof(u16), OpenGL::StreamDraw);
+    uploadPBO.unbind();
+    uploadStaging.reserve(VRAM_SIZE);
 
     vao.bind();
     vbo.bind();
@@ -240,6 +359,15 @@ void GPU_GL::init() {
     vao.setAttributeInt<GLushort>(4, 2, sizeof(Vertex), offsetof(Vertex, texcoords));
     vao.enableAttribute(4);
 
+    vao.setAttributeInt<GLuint>(5, 1, sizeof(Vertex), offsetof(Vertex, texWindow));
+    vao.enableAttribute(5);
+
+    vao.setAttributeInt<GLuint>(6, 1, sizeof(Vertex), offsetof(Vertex, blendMode));
+    vao.enableAttribute(6);
+
+    vao.setAttributeInt<GLuint>(7, 1, sizeof(Vertex), offsetof(Vertex, textureSlot));
+    vao.enableAttribute(7);
+
     OpenGL::setPackAlignment(2);
     OpenGL::setUnpackAlignment(2);
 
@@ -252,51 +380,92 @@ OpenGL::Texture& GPU_GL::getTexture() {
     return vramTex;
 }
 
+void GPU_GL::copyOutput(OpenGL::Framebuffer& target) {
+    // Called outside the draw environment, after vblank has turned the scissor test off
+    const int sourceScale = disableDisplay ? 1 : resolutionScale;
+    (disableDisplay ? blankFBO : vramFBO).bind<OpenGL::Read>();
+    target.bind<OpenGL::Draw>();
+    glBlitFramebuffer(
+        0, 0, VRAM_WIDTH * sourceScale, VRAM_HEIGHT * sourceScale, 0, 0, outputWidth(), outputHeight(), GL_COLOR_BUFFER_BIT, GL_NEAREST
+    );
+    OpenGL::bindDefaultFramebuffer();
+}
+
 void GPU_GL::setupDrawEnvironment() {
     OpenGL::enableScissor();
     vramFBO.bind();
     vao.bind();
     vbo.bind();
+    glActiveTexture(GL_TEXTURE1);
+    decodedTex.bind();
+    glActiveTexture(GL_TEXTURE0);
     sampleTex.bind();
-    OpenGL::setViewport(VRAM_WIDTH, VRAM_HEIGHT);
+    OpenGL::setViewport(VRAM_WIDTH * resolutionScale, VRAM_HEIGHT * resolutionScale);
     shaders.use();
     glUniform1i(uniformTextureLocation, 0);
+    glUniform1i(uniformDecodedTex, 1);
+    glUniform1i(uniformResolutionScale, resolutionScale);
+
+    // Blending stays on, opaque primitives get factors that simply replace the destination
+    OpenGL::enableBlend();
+    glBlendFuncSeparate(GL_SRC1_COLOR, GL_SRC1_ALPHA, GL_ONE, GL_ZERO);
+    glBlendEquation(GL_FUNC_ADD);
 }
 
 void GPU_GL::render() {
-    if (vertCount > 0) {
-        if (syncSampleTex) {
-            syncSampleTexture();
+    if (vertCount > batchStart) {
+        // Queued uploads overlapping these vertices came before them, otherwise they would have drawn the batch when queued
+        if ((batchWriteTiles() & uploadTiles).any()) flushUploads();
+        if (batchReads.any()) {
+            syncSampleTexture(batchReads);
+            batchReads.reset();
         }
 
-        vbo.subData(verts.data(), vertCount);
+        const auto count = static_cast<GLsizei>(vertCount - batchStart);
+        GLint first = 0;
+        if (vbo.isPersistent()) {
+            // Already in mapped memory, the next batch is appended behind this one
+            first = vbo.segmentFirst<Vertex>() + static_cast<GLint>(batchStart);
+            batchStart = vertCount;
+        } else {
+            vbo.subData(verts, count);
+            vertCount = 0;
+            batchStart = 0;
+        }
 
-        if (lastBlendMode == 2) {
-            glBlendEquation(GL_FUNC_ADD);
-            setBlendFactors(0.0, 1.0);
-            OpenGL::drawArrays(OpenGL::Triangles, 0, vertCount);
+        if (batchSubtractive) {
+            glUniform1i(uniformBlendPass, 1);
+            OpenGL::drawArrays(OpenGL::Triangles, first, count);
 
             glBlendEquationSeparate(GL_FUNC_REVERSE_SUBTRACT, GL_FUNC_ADD);
-            setBlendFactors(1.0, 1.0);
-            glUniform4f(uniformOpaqueBlendFactors, 0.0, 0.0, 0.0, 1.0);
-            OpenGL::drawArrays(OpenGL::Triangles, 0, vertCount);
-            glUniform4f(uniformOpaqueBlendFactors, 1.0, 1.0, 1.0, 0.0);
+            glUniform1i(uniformBlendPass, 2);
+            OpenGL::drawArrays(OpenGL::Triangles, first, count);
+
+            glBlendEquation(GL_FUNC_ADD);
+            glUniform1i(uniformBlendPass, 0);
         } else {
-            OpenGL::drawArrays(OpenGL::Triangles, 0, vertCount);
+            OpenGL::drawArrays(OpenGL::Triangles, first, count);
         }
-        verts.clear();
+        batchSlots.reset();
+        markBatchWrites();
+    }
+}
+
+void GPU_GL::nextVertexSegment() {
+    render();
+    if (vbo.isPersistent()) {
+        vbo.nextSegment();
+        verts = vbo.segmentData<Vertex>();
         vertCount = 0;
+        batchStart = 0;
     }
 }
 
 void GPU_GL::vblank() {
     render();
+    flushUploads();
     OpenGL::disableScissor();
-    if (lastTransparency == Transparency::Transparent) {
-        lastTransparency = Transparency::Opaque;
-        lastBlendMode = -1;
-        OpenGL::disableBlend();
-    }
+    OpenGL::disableBlend();
 
     vao.unbind();
     vbo.unbind();
@@ -348,11 +517,8 @@ void GPU_GL::drawCommand() {
     };
 
     switch (command) {
-        case 0x01:
-            // Flush Tex cache
-            render();
-            syncSampleTex = true;
-            break;
+        // Flush Tex cache, nothing to do as sampleTex is refreshed from the dirty tiles whenever a batch samples them
+        case 0x01: break;
         case 0x02: fillRect(); break;
         case 0x80: TransferVramToVram(); break;
         case 0xA0: prepVramTransfer(); break;
@@ -407,8 +573,6 @@ void GPU_GL::drawCommand() {
     }
 }
 
-void GPU_GL::batchRender() {}
-
 void GPU_GL::blankDraw() {}
 
 template <GPU::Polygon polygon, GPU::Shading shading, GPU::Transparency transparency>
@@ -463,6 +627,7 @@ void GPU_GL::drawPolygon() {
         u32 color = shading == TexBlendFlat ? args[0] : 0x808080;
         u16 texpage = (args[4] >> 16) & 0x3FFF;
         u16 clut = args[2] >> 16;
+        addTextureRead(texpage, clut);
         addVertex(args[1], color, texpage, clut, args[2] & 0xffff);
         addVertex(args[3], color, texpage, clut, args[4] & 0xffff);
         addVertex(args[5], color, texpage, clut, args[6] & 0xffff);
@@ -477,6 +642,7 @@ void GPU_GL::drawPolygon() {
         }
         u32 clut = args[2] >> 16;
         u16 texpage = (args[5] >> 16) & 0x3FFF;
+        addTextureRead(texpage, static_cast<u16>(clut));
         if constexpr (shading == TexBlendGouraud) {
             addVertex(args[1], args[0], texpage, clut, args[2] & 0xffff);
             addVertex(args[4], args[3], texpage, clut, args[5] & 0xffff);
@@ -554,6 +720,7 @@ void GPU_GL::drawRect() {
     u32 u = uv & 0xFF;
     u32 v = uv >> 8;
     u16 texpage = rectTexpage;
+    addTextureRead(texpage, static_cast<u16>(clut));
 
     //    int x = Helpers::signExtend16(pos, 11);
     //    int y = Helpers::signExtend16(pos, 5);
@@ -611,13 +778,13 @@ void GPU_GL::drawLine() {
 
     // Both vertices coincide, render 1x1 rectangle with the colour and coords of v1
     if (dx == 0 && dy == 0) {
-        verts.emplace_back(x1, y1, p1.color);
-        verts.emplace_back(x1 + 1, y1, p1.color);
-        verts.emplace_back(x1 + 1, y1 + 1, p1.color);
+        addVertex(x1, y1, p1.color);
+        addVertex(x1 + 1, y1, p1.color);
+        addVertex(x1 + 1, y1 + 1, p1.color);
 
-        verts.emplace_back(x1 + 1, y1 + 1, p1.color);
-        verts.emplace_back(x1, y1 + 1, p1.color);
-        verts.emplace_back(x1, y1, p1.color);
+        addVertex(x1 + 1, y1 + 1, p1.color);
+        addVertex(x1, y1 + 1, p1.color);
+        addVertex(x1, y1, p1.color);
     } else {
         int xOffset, yOffset;
         if (absDx > absDy) {  // x-major line
@@ -634,17 +801,20 @@ void GPU_GL::drawLine() {
             dy > 0 ? y2++ : y1++;
         }
 
-        verts.emplace_back(x1, y1, p1.color);
-        verts.emplace_back(x2, y2, p2.color);
-        verts.emplace_back(x2 + xOffset, y2 + yOffset, p2.color);
+        addVertex(x1, y1, p1.color);
+        addVertex(x2, y2, p2.color);
+        addVertex(x2 + xOffset, y2 + yOffset, p2.color);
 
-        verts.emplace_back(x2 + xOffset, y2 + yOffset, p2.color);
-        verts.emplace_back(x1 + xOffset, y1 + yOffset, p1.color);
-        verts.emplace_back(x1, y1, p1.color);
+        addVertex(x2 + xOffset, y2 + yOffset, p2.color);
+        addVertex(x1 + xOffset, y1 + yOffset, p1.color);
+        addVertex(x1, y1, p1.color);
     }
 }
 
-void GPU_GL::updateScissorBox() const { OpenGL::setScissor(scissorBox.x, scissorBox.y, scissorBox.w, scissorBox.h); }
+void GPU_GL::updateScissorBox() const {
+    const auto scale = resolutionScale;
+    OpenGL::setScissor(scissorBox.x * scale, scissorBox.y * scale, scissorBox.w * scale, scissorBox.h * scale);
+}
 
 void GPU_GL::updateDrawAreaScissor() {
     render();
@@ -659,24 +829,19 @@ void GPU_GL::updateDrawAreaScissor() {
 
 void GPU_GL::setTextureWindow(u32 value) {
     // 8 pixel steps - multiply by 8
-    render();
+    texWindowBits = value & 0xFFFFF;
     texWindow.xMask = (value & 0x1F) * 8;
     texWindow.yMask = ((value >> 5) & 0x1F) * 8;
     texWindow.x = ((value >> 10) & 0x1F) * 8;
     texWindow.y = ((value >> 15) & 0x1F) * 8;
-    glUniform4i(uniformTextureWindow, ~texWindow.xMask, ~texWindow.yMask, texWindow.x & texWindow.xMask, texWindow.yMask & texWindow.y);
 }
 
 void GPU_GL::setDrawOffset(u32 value) {
-    render();
-
     const auto x = (s32)value << 21 >> 21;
     const auto y = (s32)value << 10 >> 21;
 
     drawOffset.x() = x;
     drawOffset.y() = y;
-
-    glUniform2f(uniformDrawOffsetLocation, static_cast<float>(drawOffset.x()) + 0.5f, static_cast<float>(drawOffset.y()) - 0.5f);
 }
 
 void GPU_GL::setDrawAreaTopLeft(u32 value) {
@@ -713,6 +878,7 @@ void GPU_GL::setMaskBitSetting(u32 value) {
 
 void GPU_GL::fillRect() {
     render();  // Render out remaining verts
+    flushUploads();
     const u32 color = args[0] & 0xFFFFFF;
     float r = float(color & 0xff) / 255.0f;
     float g = float((color >> 8) & 0xff) / 255.0f;
@@ -723,28 +889,74 @@ void GPU_GL::fillRect() {
     const u32 w = args[2] & 0xFFFF;
     const u32 h = (args[2] >> 16) & 0xFFFF;
 
-    OpenGL::setClearColor(r, g, b, 1.0f);
-    OpenGL::setScissor(x, y, w, h);
+    // Fills ignore GP0(E6h) and always clear the mask bit
+    OpenGL::setClearColor(r, g, b, 0.0f);
+    OpenGL::setScissor(scaled(x), scaled(y), scaled(w), scaled(h));
     OpenGL::clearColor();
+    markWritten(DirtyTracker::tilesOf(static_cast<int>(x), static_cast<int>(y), static_cast<int>(w), static_cast<int>(h)));
     // Set scissor box back to draw area
     updateScissorBox();
 }
 
 void GPU_GL::transferToVram() {
-    render();                          // Render out remaining verts
+    const auto [x, y, w, h] = transferRect;
+    const size_t pixels = w * h;
+    const auto tiles = DirtyTracker::tilesOf(x, y, w, h);
+
+    // Pending vertices that draw to or sample the area have to see what was there before
+    if (((batchWriteTiles() | batchReads) & tiles).any()) render();
+    if (uploadStaging.size() + pixels > VRAM_SIZE) flushUploads();
+
+    pendingUploads.push_back({transferRect, uploadStaging.size() * sizeof(u16)});
+    const auto* data = reinterpret_cast<const u16*>(transferWriteBuffer.data());
+    uploadStaging.insert(uploadStaging.end(), data, data + pixels);
+    uploadTiles |= tiles;
+    transferWriteBuffer.clear();
+
+    // Small transfers like CLUTs wait until something needs them, larger ones are not worth holding back
+    if (pixels > maxQueuedUploadPixels) flushUploads();
+}
+
+void GPU_GL::flushUploads() {
+    if (pendingUploads.empty()) return;
+
     OpenGL::bindDefaultFramebuffer();  // Unbind not to overwrite vram framebuffer
-    vramTex.bind();                    // Texture to copy into
-    glTexSubImage2D(
-        GL_TEXTURE_2D, 0, transferRect.x, transferRect.y, transferRect.w, transferRect.h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
-        transferWriteBuffer.data()
-    );
-    syncSampleTex = true;
+    OpenGL::disableScissor();
+    uploadPBO.bind();
+    uploadPBO.data(uploadStaging.data(), static_cast<int>(uploadStaging.size()), OpenGL::StreamDraw);
+
+    // The words go in as they are, into the rendered VRAM for display and blending and into sampleTex for texturing
+    for (const auto& [rect, offset] : pendingUploads) {
+        const auto* data = reinterpret_cast<const void*>(offset);
+        (resolutionScale == 1 ? vramTex : nativeTex).bind();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, data);
+        (resolutionScale == 1 ? sampleTex : nativeSampleTex).bind();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RED_INTEGER, GL_UNSIGNED_SHORT, data);
+    }
+    uploadPBO.unbind();
+
+    if (resolutionScale > 1) {
+        for (const auto& [rect, offset] : pendingUploads) {
+            nativeFBO.bind<OpenGL::Read>();
+            vramFBO.bind<OpenGL::Draw>();
+            blitScaled(rect.x, rect.y, rect.w, rect.h, true);
+            nativeSampleFBO.bind<OpenGL::Read>();
+            sampleFBO.bind<OpenGL::Draw>();
+            blitScaled(rect.x, rect.y, rect.w, rect.h, true);
+        }
+    }
+
+    // sampleTex is up to date with the uploads, tiles that were dirty before stay dirty and get packed from vramTex, which matches
+    textureCache.invalidate(uploadTiles);
+    pendingUploads.clear();
+    uploadStaging.clear();
+    uploadTiles.reset();
     setupDrawEnvironment();
-    transferWriteBuffer.clear();
 }
 
 void GPU_GL::transferToCpu() {
     render();
+    flushUploads();
     readMode = GP0Mode::Transfer;
 
     u16 x = args[1] & 0x3ff;
@@ -763,13 +975,68 @@ void GPU_GL::transferToCpu() {
     transferIndex = 0;
 
     transferRect = {x, y, w, h};
-    // Read vram data into buffer so cpu can read it
-    std::fill(transferReadBuffer.begin(), transferReadBuffer.end(), 0);
-    glReadPixels(transferRect.x, transferRect.y, transferRect.w, transferRect.h, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, transferReadBuffer.data());
+    startReadback(x, y, w, h);
+}
+
+void GPU_GL::finishTransferToCpu() {
+    if (!readbackFence) return;
+    waitReadback(transferReadBuffer.data());
+
+    // Odd sized transfers are padded to a whole word
+    if (readbackPixels & 1) reinterpret_cast<u16*>(transferReadBuffer.data())[readbackPixels] = 0;
+}
+
+void GPU_GL::flush() {
+    render();
+    flushUploads();
+    // A VRAM->CPU transfer still in the pixel buffer is collected first, the whole of VRAM goes through the same buffer
+    finishTransferToCpu();
+    startReadback(0, 0, VRAM_WIDTH, VRAM_HEIGHT);
+    waitReadback(vram.data());
+}
+
+void GPU_GL::startReadback(int x, int y, int w, int h) {
+    // The raw words are read from sampleTex, which only needs the area brought up to date
+    syncSampleTexture(DirtyTracker::tilesOf(x, y, w, h));
+    OpenGL::disableScissor();
+    sampleFBO.bind<OpenGL::Read>();
+    if (resolutionScale > 1) {
+        // Downsample the area first, the CPU always sees native resolution VRAM
+        nativeSampleFBO.bind<OpenGL::Draw>();
+        blitScaled(x, y, w, h, false);
+        nativeSampleFBO.bind<OpenGL::Read>();
+    }
+
+    // Read vram data into a pixel buffer, the CPU only waits for it once the first word is read
+    readbackPBO.bind();
+    glReadPixels(x, y, w, h, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+    readbackPBO.unbind();
+
+    vramFBO.bind();
+    OpenGL::enableScissor();
+
+    if (readbackFence) glDeleteSync(readbackFence);
+    readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readbackPixels = static_cast<size_t>(w * h);
+}
+
+void GPU_GL::waitReadback(void* destination) {
+    while (glClientWaitSync(readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(readbackFence);
+    readbackFence = nullptr;
+
+    const auto bytes = readbackPixels * sizeof(u16);
+    readbackPBO.bind();
+    const auto* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_READ_BIT);
+    std::memcpy(destination, pixels, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    readbackPBO.unbind();
 }
 
 void GPU_GL::TransferVramToVram() {
     render();
+    flushUploads();
     OpenGL::disableScissor();
 
     u32 src = args[1];
@@ -787,97 +1054,131 @@ void GPU_GL::TransferVramToVram() {
     width = ((width - 1) & 0x3ff) + 1;
     height = ((height - 1) & 0x1ff) + 1;
 
-    glBlitFramebuffer(srcX, srcY, srcX + width, srcY + height, dstX, dstY, dstX + width, dstY + height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBlitFramebuffer(
+        scaled(srcX), scaled(srcY), scaled(srcX + width), scaled(srcY + height), scaled(dstX), scaled(dstY), scaled(dstX + width),
+        scaled(dstY + height), GL_COLOR_BUFFER_BIT, GL_LINEAR
+    );
+    markWritten(DirtyTracker::tilesOf(static_cast<int>(dstX), static_cast<int>(dstY), static_cast<int>(width), static_cast<int>(height)));
     OpenGL::enableScissor();
 }
 
-void GPU_GL::syncSampleTexture() {
-    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, VRAM_WIDTH, VRAM_HEIGHT);
-    syncSampleTex = false;
-}
-
-void GPU_GL::hblankEvent() {
-    // timers step hblank
-    //    scheduler.scheduleEvent(CYCLES_PER_HDRAW, [&]{
-    //        hblankEvent();
-    //    });
-}
-
-void GPU_GL::scanlineEvent() {
-    //    lineCount++;
-    //
-    //    if (lineCount < SCANLINES_PER_VDRAW) {
-    //       if (lineCount & 1) {
-    //            gpustat |= 1 << 31;
-    //       } else {
-    //            gpustat &= ~(1 << 31);
-    //       }
-    //    } else {
-    //        gpustat |= 1 << 31;
-    //    }
-    //
-    //    if (lineCount == SCANLINES_PER_VDRAW) {
-    //        //vblank
-    //        scheduler.scheduleInterrupt(1, Bus::IRQ::VBLANK);
-    //        inVblank = true;
-    //        updateScreen = true;
-    //    } else if (lineCount == SCANLINES_PER_FRAME) {
-    //        // vblank end
-    //        inVblank = false;
-    //        lineCount = 0;
-    //    }
-    //
-    //    scheduler.scheduleEvent(CYCLES_PER_SCANLINE, [&]{
-    //        scanlineEvent();
-    //    });
+void GPU_GL::blitScaled(int x, int y, int width, int height, bool upscale) {
+    const int scale = resolutionScale;
+    const int right = x + width;
+    const int bottom = y + height;
+    // Nearest filtering keeps the mask bit and exact 15-bit colours of uploaded data intact, and is the only choice for raw words
+    if (upscale) {
+        glBlitFramebuffer(x, y, right, bottom, x * scale, y * scale, right * scale, bottom * scale, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    } else {
+        glBlitFramebuffer(x * scale, y * scale, right * scale, bottom * scale, x, y, right, bottom, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
 }
 
-template <GPU::Transparency transparency>
-void GPU_GL::setTransparency() {
-    if (lastTransparency != transparency) {
-        render();
-        if constexpr (transparency == Transparency::Opaque) {
-            lastBlendMode = -1;
-            OpenGL::disableBlend();
-        } else {
-            OpenGL::enableBlend();
-        }
-        lastTransparency = transparency;
+void GPU_GL::syncSampleTexture(const DirtyTracker::Mask& tiles) {
+    // Only the written areas about to be sampled need to reach sampleTex, the rest can stay stale
+    const auto dirty = sampleDirty.take(tiles);
+    if (dirty.none()) return;
+
+    OpenGL::disableScissor();
+    OpenGL::disableBlend();
+    sampleFBO.bind();
+    glActiveTexture(GL_TEXTURE2);
+    vramTex.bind();
+    glActiveTexture(GL_TEXTURE0);
+    packShaders.use();
+
+    const auto scale = resolutionScale;
+    DirtyTracker::forEachRun(dirty, [scale](int x, int y, int width, int height) {
+        OpenGL::setViewport(x * scale, y * scale, width * scale, height * scale);
+        OpenGL::drawArrays(OpenGL::TriangleStrip, 0, 4);
+    });
+    setupDrawEnvironment();
+}
+
+DirtyTracker::Mask GPU_GL::batchWriteTiles() {
+    if (batchBounds != writeTilesBounds) {
+        const int left = std::max<int>(batchBounds.left, drawArea.left);
+        const int top = std::max<int>(batchBounds.top, drawArea.top);
+        const int right = std::min<int>({batchBounds.right, drawArea.right, VRAM_WIDTH - 1});
+        const int bottom = std::min<int>({batchBounds.bottom, drawArea.bottom, VRAM_HEIGHT - 1});
+
+        writeTiles = DirtyTracker::tilesOf(left, top, right - left + 1, bottom - top + 1);
+        writeTilesBounds = batchBounds;
     }
+    return writeTiles;
 }
 
-void GPU_GL::setBlendFactors(float source, float destination) {
-    if (blendFactors.x() != source || blendFactors.y() != destination) {
-        blendFactors.x() = source;
-        blendFactors.y() = destination;
+void GPU_GL::markBatchWrites() {
+    markWritten(batchWriteTiles());
+    batchBounds = emptyBounds;
+    writeTilesBounds = emptyBounds;
+    writeTiles.reset();
+}
 
-        glUniform4f(uniformBlendFactors, source, source, source, destination);
+void GPU_GL::addTextureRead(u16 texpage, u16 clut) {
+    if (texpage != lastReadTexpage || clut != lastReadClut) {
+        lastReadTexpage = texpage;
+        lastReadClut = clut;
+        lastReadTiles = DirtyTracker::textureTiles(texpage, clut);
+    }
+
+    // Sampling something drawn earlier in this batch needs that part drawn and copied to sampleTex first
+    if ((batchWriteTiles() & lastReadTiles).any()) render();
+    if ((uploadTiles & lastReadTiles).any()) flushUploads();
+
+    if (TextureCache::cacheable(texpage)) {
+        bool decode;
+        const size_t slot = textureCache.lookup(texpage, clut, decode);
+        if (decode) decodeTexture(slot, texpage, clut);
+        batchSlots.set(slot);
+        textureSlot = static_cast<u32>(slot);
+        return;
+    }
+    batchReads |= lastReadTiles;
+}
+
+void GPU_GL::decodeTexture(size_t slot, u16 texpage, u16 clut) {
+    // Queued vertices may still sample the page the slot held before
+    if (batchSlots[slot]) render();
+    // Nothing pending writes to the source, the check in addTextureRead drew it already
+    syncSampleTexture(lastReadTiles);
+
+    constexpr int size = TextureCache::PAGE_SIZE;
+    const auto index = static_cast<int>(slot);
+    OpenGL::disableScissor();
+    OpenGL::disableBlend();
+    decodeFBO.bind();
+    OpenGL::setViewport((index % atlasSlotsX) * size, (index / atlasSlotsX) * size, size, size);
+    decodeShaders.use();
+    glUniform1i(uniformDecodeTexpage, texpage);
+    glUniform1i(uniformDecodeClut, clut);
+    OpenGL::drawArrays(OpenGL::TriangleStrip, 0, 4);
+
+    setupDrawEnvironment();
+}
+
+void GPU_GL::markWritten(const DirtyTracker::Mask& tiles) {
+    sampleDirty.mark(tiles);
+    textureCache.invalidate(tiles);
+}
+
+template <GPU::Transparency transparency>
+void GPU_GL::setTransparency() {
+    if constexpr (transparency == Transparency::Opaque) {
+        setBlendMode(opaqueBlendMode);
     }
 }
 
-void GPU_GL::setBlendModeTexpage(u32 texpage) {
-    const auto blendMode = (texpage >> 5) & 3;
-    if (lastBlendMode != blendMode) {
+void GPU_GL::setBlendMode(u32 mode) {
+    // The blend factors come from the vertices, only the subtractive mode needs another blend equation and so its own batch
+    const bool subtractive = mode == 2;
+    if (subtractive != batchSubtractive) {
         render();
-        lastBlendMode = blendMode;
-        glBlendFuncSeparate(GL_SRC1_COLOR, GL_SRC1_ALPHA, GL_ONE, GL_ZERO);
-
-        switch (blendMode) {
-            case 0:
-                glBlendEquation(GL_FUNC_ADD);
-                setBlendFactors(0.5, 0.5);
-                break;
-            case 1:
-                glBlendEquation(GL_FUNC_ADD);
-                setBlendFactors(1.0, 0.0);
-                break;
-            case 2: break;
-            case 3:
-                glBlendEquation(GL_FUNC_ADD);
-                setBlendFactors(0.25, 1.0);
-                break;
-        }
+        batchSubtractive = subtractive;
     }
+    blendMode = mode;
 }
 
+void GPU_GL::setBlendModeTexpage(u32 texpage) { setBlendMode((texpage >> 5) & 3); }
+
 }  // namespace GPU
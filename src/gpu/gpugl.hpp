@@ -1,7 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <climits>
 #include <vector>
 
+#include "dirtytracker.hpp"
 #include "gpu.hpp"
+#include "texturecache.hpp"
 
 namespace GPU {
 
@@ -11,6 +15,10 @@ struct Vertex {
     u16 texpage;
     u16 clut;
     OpenGL::Vector<GLushort, 2> texcoords;
+    // Per primitive state, filled in by GPU_GL::addVertex so that state changes do not split the batch
+    u32 texWindow = 0;  // Raw GP0(E2h) texture window bits
+    u32 blendMode = 0;  // Semi-transparency mode, or opaqueBlendMode, plus GPU_GL::maskBitFlag when GP0(E6h) sets the mask bit
+    u32 textureSlot = 0;  // Texture cache slot holding the decoded page of 4bpp and 8bpp primitives
 
     Vertex() : position({0, 0}), color(0), texpage(0), clut(0), texcoords({0, 0}) {}
     Vertex(u32 pos, u32 color) : color(color) {
@@ -18,9 +26,9 @@ struct Vertex {
         texpage = 0x8000;
     }
 
-    Vertex(u32 x, u32 y, u32 color) : color(color) {
-        position.x() = int(x) << 21 >> 21;
-        position.y() = int(y) << 21 >> 21;
+    Vertex(s32 x, s32 y, u32 color) : color(color) {
+        position.x() = x << 21 >> 21;
+        position.y() = y << 21 >> 21;
         texpage = 0x8000;
     }
 
@@ -31,14 +39,14 @@ struct Vertex {
         texcoords.y() = (texCoords >> 8) & 0xFF;
     }
 
-    Vertex(u32 x, u32 y, u32 color, u16 texpage, u16 clut, u16 tx, u16 ty) : color(color), texpage(texpage), clut(clut) {
-        position.x() = int(x) << 21 >> 21;
-        position.y() = int(y) << 21 >> 21;
-        texcoords.x() = tx;
-        texcoords.y() = ty;
+    Vertex(s32 x, s32 y, u32 color, u16 texpage, u32 clut, u32 tx, u32 ty) : color(color), texpage(texpage), clut(static_cast<u16>(clut)) {
+        position.x() = x << 21 >> 21;
+        position.y() = y << 21 >> 21;
+        texcoords.x() = static_cast<GLushort>(tx);
+        texcoords.y() = static_cast<GLushort>(ty);
     }
 
-    Vertex(u32 pos, u32 color, u16 texpage, u16 clut, u16 texCoords) : color(color), texpage(texpage), clut(clut) {
+    Vertex(u32 pos, u32 color, u16 texpage, u32 clut, u32 texCoords) : color(color), texpage(texpage), clut(static_cast<u16>(clut)) {
         setPosition(pos);
         texcoords.x() = texCoords & 0xFF;
         texcoords.y() = (texCoords >> 8) & 0xFF;
@@ -54,40 +62,65 @@ struct Vertex {
 
 class GPU_GL final : public GPU {
   public:
-    GPU_GL(Scheduler::Scheduler& scheduler);
+    // VRAM is rendered at resolutionScale times the native 1024x512, clamped to [1, maxResolutionScale]
+    GPU_GL(Scheduler::Scheduler& scheduler, int resolutionScale = 1);
     virtual ~GPU_GL();
 
     void reset() override;
     void init();
 
     OpenGL::Texture& getTexture();
+    // Copies what getTexture() shows into a framebuffer of outputWidth() x outputHeight(), for presenting from another context
+    void copyOutput(OpenGL::Framebuffer& target);
+    [[nodiscard]] int outputWidth() const { return VRAM_WIDTH * resolutionScale; }
+    [[nodiscard]] int outputHeight() const { return VRAM_HEIGHT * resolutionScale; }
 
     void setupDrawEnvironment();
     void render();
-    void vblank();
-
-    bool inVblank = false;
-    bool updateScreen = false;
+    void vblank() override;
+    // Reads all of VRAM back into the CPU side copy, for frontends that take frames from getVRAM()
+    void flush() override;
 
   private:
     void maybeRender(size_t count) {
-        if (verts.size() + count >= vboSize) {
-            batchRender();
+        if (vertCount + count > vboSegmentVerts) {
+            nextVertexSegment();
         }
     }
 
+    // Vertices are written straight into the mapped vertex buffer when persistent mapping is available
     template <class... Args>
     void addVertex(Args&&... values) {
-        verts.emplace_back(std::forward<Args>(values)...);
-        vertCount++;
+        Vertex vertex(std::forward<Args>(values)...);
+        vertex.position.x() += drawOffset.x();
+        vertex.position.y() += drawOffset.y();
+        vertex.texWindow = texWindowBits;
+        vertex.blendMode = blendMode | (setMaskBit ? maskBitFlag : 0);
+        vertex.textureSlot = textureSlot;
+        verts[vertCount++] = vertex;
+
+        batchBounds.left = std::min(batchBounds.left, vertex.position.x());
+        batchBounds.top = std::min(batchBounds.top, vertex.position.y());
+        batchBounds.right = std::max(batchBounds.right, vertex.position.x());
+        batchBounds.bottom = std::max(batchBounds.bottom, vertex.position.y());
     }
 
-    void batchRender();
+    void addTextureRead(u16 texpage, u16 clut);
+    void decodeTexture(size_t slot, u16 texpage, u16 clut);
+    void markWritten(const DirtyTracker::Mask& tiles);
+    DirtyTracker::Mask batchWriteTiles();
+
+    void nextVertexSegment();
 
     void drawCommand() override;
     void internalCommand(u32 value) override;
     void transferToVram() override;
+    void flushUploads();
     void transferToCpu() override;
+    void finishTransferToCpu() override;
+    // Reads a native resolution VRAM area into readbackPBO, waitReadback() copies it out once the GPU is done
+    void startReadback(int x, int y, int w, int h);
+    void waitReadback(void* destination);
     void TransferVramToVram() override;
 
     void setDrawMode(u32 value) override;
@@ -99,7 +132,10 @@ class GPU_GL final : public GPU {
 
     void updateScissorBox() const;
     void updateDrawAreaScissor();
-    void syncSampleTexture();
+    void syncSampleTexture(const DirtyTracker::Mask& tiles);
+    // Blits a VRAM area between a native and a scaled framebuffer, which have to be bound for reading and drawing already
+    void blitScaled(int x, int y, int width, int height, bool upscale);
+    void markBatchWrites();
     void fillRect();
 
     template <Polygon polygon, Shading shading, Transparency transparency>
@@ -113,47 +149,96 @@ class GPU_GL final : public GPU {
 
     void blankDraw();
 
-    void hblankEvent();
-    void scanlineEvent();
-
-    std::vector<Vertex> verts;
-    size_t vertCount = 0;
+    Vertex* verts = nullptr;
+    size_t vertCount = 0;   // Vertices written to the current segment
+    size_t batchStart = 0;  // First vertex of the segment that has not been drawn yet
+    std::vector<Vertex> fallbackVerts;
+
+    struct Bounds {
+        int left, top, right, bottom;
+        bool operator==(const Bounds&) const = default;
+    };
+
+    static constexpr Bounds emptyBounds = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+    Bounds batchBounds = emptyBounds;  // Bounds of the pending vertices, draw offset included
+    Bounds writeTilesBounds = emptyBounds;
+    DirtyTracker::Mask writeTiles;  // Tiles covered by writeTilesBounds, recomputed once the batch grows
+
+    DirtyTracker sampleDirty;       // VRAM written since sampleTex last caught up with it
+    DirtyTracker::Mask batchReads;  // Texture pages and CLUTs the pending vertices sample
+    u16 lastReadTexpage = 0xFFFF;
+    u16 lastReadClut = 0;
+    DirtyTracker::Mask lastReadTiles;
+
+    // CPU->VRAM transfers waiting to be uploaded together, their pixels are packed back to back in uploadStaging
+    struct PendingUpload {
+        Rect<u16> rect;
+        size_t offset;  // In bytes
+    };
+
+    static constexpr size_t maxQueuedUploadPixels = 64 * 64;
+    std::vector<PendingUpload> pendingUploads;
+    std::vector<u16> uploadStaging;
+    DirtyTracker::Mask uploadTiles;  // Tiles covered by pendingUploads
+
+    // Paletted pages decoded to direct colour, in an atlas of TextureCache::SLOTS pages of 256x256
+    static constexpr int atlasSlotsX = 8;
+    TextureCache textureCache;
+    std::bitset<TextureCache::SLOTS> batchSlots;  // Slots sampled by the pending vertices
+    u32 textureSlot = 0;
 
     OpenGL::VertexBuffer vbo;
+    OpenGL::VertexBuffer readbackPBO;
+    OpenGL::VertexBuffer uploadPBO;
+    GLsync readbackFence = nullptr;
+    size_t readbackPixels = 0;
     OpenGL::VertexArray vao;
     OpenGL::Framebuffer vramFBO;
     OpenGL::Framebuffer blankFBO;
     OpenGL::Texture vramTex;
     OpenGL::Texture blankTex;
-    OpenGL::Texture sampleTex;
+    OpenGL::Framebuffer sampleFBO;
+    OpenGL::Texture sampleTex;  // R16UI copy of VRAM in raw pixel words that textures are sampled from
+    OpenGL::Framebuffer nativeFBO;
+    OpenGL::Texture nativeTex;
+    OpenGL::Framebuffer nativeSampleFBO;
+    OpenGL::Texture nativeSampleTex;
+    OpenGL::Framebuffer decodeFBO;
+    OpenGL::Texture decodedTex;
 
     Rect<int> scissorBox;
 
     OpenGL::ShaderProgram shaders;
     GLint uniformTextureLocation = 0;
-    GLint uniformTextureWindow = 0;
-    GLint uniformDrawOffsetLocation = 0;
-    GLint uniformBlendFactors = 0;
-    GLint uniformOpaqueBlendFactors = 0;
-    OpenGL::vec2 blendFactors;
-    Transparency lastTransparency = Transparency::Opaque;
-    int lastBlendMode = -1;
+    GLint uniformBlendPass = 0;
+    GLint uniformResolutionScale = 0;
+    GLint uniformDecodedTex = 0;
+
+    OpenGL::ShaderProgram decodeShaders;
+    OpenGL::ShaderProgram packShaders;
+    GLint uniformDecodeTexpage = 0;
+    GLint uniformDecodeClut = 0;
+
+    static constexpr int maxResolutionScale = 8;
+    const int resolutionScale;
+    // Native VRAM coordinate in the scaled framebuffers
+    [[nodiscard]] GLint scaled(u32 value) const { return static_cast<GLint>(value) * resolutionScale; }
+
+    static constexpr u32 opaqueBlendMode = 4;
+    static constexpr u32 maskBitFlag = 8;
+    u32 blendMode = opaqueBlendMode;  // Blend mode of the primitive being added
+    u32 texWindowBits = 0;
+    bool batchSubtractive = false;  // Pending batch uses blend mode 2, which is drawn in two passes
 
     template <Transparency transparency>
     void setTransparency();
 
-    void setBlendFactors(float source, float destination);
+    void setBlendMode(u32 mode);
     void setBlendModeTexpage(u32 texpage);
 
-    static constexpr int vboSize = 0x100000;
-    bool syncSampleTex = false;
+    static constexpr size_t vboSegmentVerts = 0x10000;
+    static constexpr int vboSegments = 3;
     bool updateDrawOffset = false;
-
-    static constexpr u64 CYCLES_PER_HDRAW = 2560 / 1.57;
-    static constexpr u64 CYCLES_PER_SCANLINE = 3413 / 1.57;  // NTSC
-    static constexpr u64 SCANLINES_PER_VDRAW = 240;
-    static constexpr u64 SCANLINES_PER_FRAME = 263;
-    u64 lineCount = 0;
 };
 
 }  // namespace GPU
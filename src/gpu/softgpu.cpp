@@ -1,12 +1,1048 @@
 #include "softgpu.hpp"
 
+#include <algorithm>
+
+// SSE2 is part of the x86-64 baseline, triangle spans are shaded 8 pixels at a time there
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFTGPU_SSE2 1
+#endif
+
 namespace GPU {
 
-void SoftGPU::reset() { GPU::reset(); }
+namespace {
+constexpr s32 ditherTable[4][4] = {{-4, 0, -3, 1}, {2, -2, 3, -1}, {-3, 1, -4, 0}, {3, -1, 2, -2}};
+}  // namespace
+
+// The emulation thread keeps one core busy, the render thread joins the pool for the rest
+SoftGPU::SoftGPU(Scheduler::Scheduler& events) : GPU(events), pool(std::max(std::thread::hardware_concurrency(), 2u) - 1) {
+    batch.reserve(MAX_BATCH_SIZE);
+    batchPages.reserve(MAX_BATCH_SIZE);
+    decodedPages.resize(TextureCache::SLOTS * TextureCache::PAGE_SIZE * TextureCache::PAGE_SIZE);
+    renderThread = std::thread(&SoftGPU::renderLoop, this);
+}
+
+SoftGPU::~SoftGPU() {
+    auto& packet = ring.acquire();
+    packet.type = PacketType::Quit;
+    ring.publish();
+    renderThread.join();
+}
+
+void SoftGPU::reset() {
+    flush();
+    GPU::reset();
+    std::fill(vram.begin(), vram.end(), 0);
+    textureCache.clear();
+    drawArea.left = 0;
+    drawArea.top = 0;
+    drawArea.right = VRAM_WIDTH;
+    drawArea.bottom = VRAM_HEIGHT;
+    submitState();
+}
+
 void SoftGPU::init() {}
-void SoftGPU::drawCommand() {}
-void SoftGPU::transferToVram() {}
-void SoftGPU::transferToCpu() {}
-void SoftGPU::TransferVramToVram() {}
-void SoftGPU::internalCommand(u32 value) {}
+
+void SoftGPU::flush() {
+    submitSync();
+    ring.waitUntilEmpty();
+}
+
+// Get the frame's batch drawn even if nothing reads vram back
+void SoftGPU::vblank() { submitSync(); }
+
+void SoftGPU::submitSync() {
+    auto& packet = ring.acquire();
+    packet.type = PacketType::Sync;
+    ring.publish();
+}
+
+void SoftGPU::submitCommand() {
+    auto& packet = ring.acquire();
+    packet.type = PacketType::Command;
+    packet.command = command;
+    packet.length = static_cast<u8>(args.size());
+    std::copy(args.begin(), args.end(), packet.words.begin());
+    ring.publish();
+}
+
+void SoftGPU::submitState() {
+    auto& packet = ring.acquire();
+    packet.type = PacketType::State;
+    packet.state = {
+        .drawArea = drawArea,
+        .texWindow = texWindow,
+        .drawOffsetX = drawOffset.x(),
+        .drawOffsetY = drawOffset.y(),
+        .rectTexpage = rectTexpage,
+        .semiTrans = semiTrans,
+        .dither = dither,
+        .setMaskBit = setMaskBit,
+        .preserveMaskedPixels = preserveMaskedPixels,
+        .rectTextureFlipX = rectTextureFlipX,
+        .rectTextureFlipY = rectTextureFlipY,
+    };
+    ring.publish();
+}
+
+void SoftGPU::renderLoop() {
+    while (true) {
+        const auto& packet = ring.front();
+        switch (packet.type) {
+            case PacketType::Command: queueDraw(packet); break;
+            case PacketType::State: state = packet.state; break;
+            case PacketType::Upload:
+                flushBatch();
+                uploadRect = {static_cast<u16>(packet.words[0]), static_cast<u16>(packet.words[1]), static_cast<u16>(packet.words[2]),
+                              static_cast<u16>(packet.words[3])};
+                uploadIndex = 0;
+                textureCache.invalidate(DirtyTracker::tilesOf(uploadRect.x, uploadRect.y, uploadRect.w, uploadRect.h));
+                break;
+            case PacketType::UploadData: uploadData(packet.words.data(), packet.length); break;
+            case PacketType::Sync: flushBatch(); break;
+            case PacketType::Quit: ring.pop(); return;
+        }
+        ring.pop();
+    }
+}
+
+static DrawArea clampToVram(const DrawArea& area) {
+    return {area.left, area.top, std::min<u16>(area.right, GPU::VRAM_WIDTH - 1), std::min<u16>(area.bottom, GPU::VRAM_HEIGHT - 1)};
+}
+
+void SoftGPU::queueDraw(const Packet& packet) {
+    const auto* words = packet.words.data();
+
+    // Fills, copies and anything unrecognised are not bound to the draw area, they run in order once the batch has landed
+    DrawArea bounds;
+    if (!drawBounds(packet.command, words, bounds)) {
+        flushBatch();
+        drawSerial(packet.command, words);
+        textureCache.invalidate(serialWrites(packet.command, words));
+        return;
+    }
+    if (bounds.left > bounds.right || bounds.top > bounds.bottom) return;
+
+    TileMask writes;
+    markTiles(writes, bounds.left, bounds.top, bounds.right - bounds.left + 1, bounds.bottom - bounds.top + 1);
+    const auto written = DirtyTracker::tilesOf(bounds.left, bounds.top, bounds.right - bounds.left + 1, bounds.bottom - bounds.top + 1);
+
+    // Textures have to be sampled after everything drawn before them and before anything drawn after them.
+    // A primitive sampling its own output depends on the order pixels are visited in, so it cannot be split over tiles at all
+    TileMask reads;
+    if (textureReads(packet.command, words, reads) && (reads & writes).any()) {
+        flushBatch();
+        drawSerial(packet.command, words);
+        textureCache.invalidate(written);
+        return;
+    }
+    if ((reads & batchWrites).any() || (writes & batchReads).any()) flushBatch();
+
+    // Looked up before this command's own writes are accounted for, they never overlap its texture
+    const auto* page = decodedPage(packet.command, words);
+    textureCache.invalidate(written);
+
+    const auto index = static_cast<u32>(batch.size());
+    batch.push_back(packet);
+    batch.back().state = state;
+    batchPages.push_back(page);
+
+    for (s32 ty = bounds.top / TILE_SIZE; ty <= bounds.bottom / TILE_SIZE; ty++) {
+        for (s32 tx = bounds.left / TILE_SIZE; tx <= bounds.right / TILE_SIZE; tx++) {
+            bins[static_cast<size_t>(ty * TILES_X + tx)].push_back(index);
+        }
+    }
+    batchWrites |= writes;
+    batchReads |= reads;
+
+    if (batch.size() >= MAX_BATCH_SIZE) flushBatch();
+}
+
+void SoftGPU::flushBatch() {
+    if (batch.empty()) return;
+
+    std::vector<u32> tiles;
+    for (u32 tile = 0; tile < TILE_COUNT; tile++) {
+        if (!bins[tile].empty()) tiles.push_back(tile);
+    }
+
+    const auto drawTile = [&](size_t i) {
+        const auto tile = tiles[i];
+        const auto tileX = static_cast<u16>((tile % TILES_X) * TILE_SIZE);
+        const auto tileY = static_cast<u16>((tile / TILES_X) * TILE_SIZE);
+
+        for (const auto index : bins[tile]) {
+            const auto& packet = batch[index];
+            const auto area = clampToVram(packet.state.drawArea);
+            const DrawArea clip = {std::max(area.left, tileX), std::max(area.top, tileY), std::min<u16>(area.right, tileX + TILE_SIZE - 1),
+                                   std::min<u16>(area.bottom, tileY + TILE_SIZE - 1)};
+            Rasterizer(vram, packet.state, clip, batchPages[index]).execute(packet.command, packet.words.data());
+        }
+        bins[tile].clear();
+    };
+
+    if (tiles.size() == 1) {
+        drawTile(0);
+    } else {
+        pool.parallelFor(tiles.size(), drawTile);
+    }
+
+    batch.clear();
+    batchPages.clear();
+    batchSlots.reset();
+    batchWrites.reset();
+    batchReads.reset();
+}
+
+void SoftGPU::drawSerial(u8 opcode, const u32* words) { Rasterizer(vram, state, clampToVram(state.drawArea)).execute(opcode, words); }
+
+bool SoftGPU::drawBounds(u8 opcode, const u32* words, DrawArea& bounds) const {
+    const auto position = [&](u32 word, s32& x, s32& y) {
+        x = (s32(word) << 21 >> 21) + state.drawOffsetX;
+        y = (s32(word) << 5 >> 21) + state.drawOffsetY;
+    };
+
+    s32 minX = INT32_MAX, minY = INT32_MAX, maxX = INT32_MIN, maxY = INT32_MIN;
+    const auto extend = [&](s32 x, s32 y) {
+        minX = std::min(minX, x), maxX = std::max(maxX, x);
+        minY = std::min(minY, y), maxY = std::max(maxY, y);
+    };
+
+    if (opcode >= 0x20 && opcode < 0x40) {
+        const bool textured = opcode & 0x04;
+        const bool gouraud = opcode & 0x10;
+        const int count = (opcode & 0x08) ? 4 : 3;
+        const int stride = 1 + gouraud + textured;
+        for (int i = 0; i < count; i++) {
+            s32 x, y;
+            position(words[1 + i * stride], x, y);
+            extend(x, y);
+        }
+    } else if (opcode >= 0x40 && opcode < 0x60) {
+        if (opcode & 0x08) return false;  // Polylines are not drawn
+        s32 x, y;
+        position(words[1], x, y);
+        extend(x, y);
+        position(words[(opcode & 0x10) ? 3 : 2], x, y);
+        extend(x, y);
+    } else if (opcode >= 0x60 && opcode < 0x80) {
+        static constexpr s32 sizes[4] = {0, 1, 8, 16};
+        const bool textured = opcode & 0x04;
+        s32 x, y;
+        position(words[1], x, y);
+        s32 width = sizes[(opcode >> 3) & 3];
+        s32 height = width;
+        if (width == 0) {
+            const u32 dimensions = words[textured ? 3 : 2];
+            width = dimensions & 0x3ff;
+            height = (dimensions >> 16) & 0x1ff;
+        }
+        extend(x, y);
+        extend(x + width - 1, y + height - 1);
+    } else {
+        return false;
+    }
+
+    const auto area = clampToVram(state.drawArea);
+    bounds.left = static_cast<u16>(std::max<s32>(minX, area.left));
+    bounds.top = static_cast<u16>(std::max<s32>(minY, area.top));
+    bounds.right = static_cast<u16>(std::clamp<s32>(maxX, 0, area.right));
+    bounds.bottom = static_cast<u16>(std::clamp<s32>(maxY, 0, area.bottom));
+    if (maxX < area.left || maxY < area.top || minX > area.right || minY > area.bottom) bounds = {1, 1, 0, 0};
+    return true;
+}
+
+bool SoftGPU::textureSource(u8 opcode, const u32* words, u16& texpage, u16& clut) const {
+    const bool polygon = opcode >= 0x20 && opcode < 0x40;
+    const bool rect = opcode >= 0x60 && opcode < 0x80;
+    if (!(polygon || rect) || !(opcode & 0x04)) return false;
+
+    const int stride = 2 + ((opcode & 0x10) ? 1 : 0);
+    texpage = polygon ? u16((words[2 + stride] >> 16) & 0x3FFF) : state.rectTexpage;
+    clut = static_cast<u16>(words[2] >> 16);
+    return true;
+}
+
+bool SoftGPU::textureReads(u8 opcode, const u32* words, TileMask& tiles) const {
+    u16 texpage, clut;
+    if (!textureSource(opcode, words, texpage, clut)) return false;
+    const u32 depth = (texpage >> 7) & 3;
+
+    // A 4bpp page covers 64 halfwords horizontally, 8bpp 128 and 15bpp 256
+    markTiles(tiles, (texpage & 0xF) * 64, ((texpage >> 4) & 1) * 256, depth == T4 ? 64 : depth == T8 ? 128 : 256, 256);
+    if (depth == T4 || depth == T8) markTiles(tiles, (clut & 0x3F) * 16, (clut >> 6) & 0x1FF, depth == T4 ? 16 : 256, 1);
+    return true;
+}
+
+DirtyTracker::Mask SoftGPU::serialWrites(u8 opcode, const u32* words) const {
+    switch (opcode) {
+        case 0x02: return DirtyTracker::tilesOf(words[1] & 0x3F0, (words[1] >> 16) & 0x1FF, ((words[2] & 0x3FF) + 0xF) & ~0xFu, (words[2] >> 16) & 0x1FF);
+        case 0x80: return DirtyTracker::tilesOf(words[2] & 0x3FF, (words[2] >> 16) & 0x1FF, ((words[3] - 1) & 0x3FF) + 1, (((words[3] >> 16) - 1) & 0x1FF) + 1);
+        default: return {};  // Polylines are not drawn
+    }
+}
+
+const u16* SoftGPU::decodedPage(u8 opcode, const u32* words) {
+    u16 texpage, clut;
+    if (!textureSource(opcode, words, texpage, clut) || !TextureCache::cacheable(texpage)) return nullptr;
+
+    bool decode;
+    const size_t slot = textureCache.lookup(texpage, clut, decode);
+    auto* page = &decodedPages[slot * TextureCache::PAGE_SIZE * TextureCache::PAGE_SIZE];
+    if (decode) {
+        // The source is already current, a batch drawing to it has been flushed before. Queued commands may still sample the
+        // page the slot held though
+        if (batchSlots[slot]) flushBatch();
+        TextureCache::decode(vram.data(), texpage, clut, page);
+    }
+    batchSlots.set(slot);
+    return page;
+}
+
+void SoftGPU::markTiles(TileMask& tiles, s32 x, s32 y, s32 width, s32 height) {
+    // Texture pages and CLUTs wrap around the edges of VRAM
+    for (s32 ty = y / TILE_SIZE; ty <= (y + height - 1) / TILE_SIZE; ty++) {
+        for (s32 tx = x / TILE_SIZE; tx <= (x + width - 1) / TILE_SIZE; tx++) {
+            tiles.set(static_cast<size_t>((ty % TILES_Y) * TILES_X + tx % TILES_X));
+        }
+    }
+}
+
+void SoftGPU::internalCommand(u32 value) {
+    switch (command) {
+        // NOP
+        case 0x00: break;
+        // Clear texture Cache
+        case 0x01: break;
+        // Draw Mode
+        case 0xE1: setDrawMode(value); break;
+        // Texture Window
+        case 0xE2: setTextureWindow(value); break;
+        // Draw Area Top/Left
+        case 0xE3: setDrawAreaTopLeft(value); break;
+        // Draw Area Bottom/Right
+        case 0xE4: setDrawAreaBottomRight(value); break;
+        // Draw Offset
+        case 0xE5: setDrawOffset(value); break;
+        // Mask Bit Setting
+        case 0xE6: setMaskBitSetting(value); break;
+        default: Log::warn("[GPU] GP0 Internal - Unhandled command: {:#02X}\n", command); return;
+    }
+    updateGPUStat();
+    if (command >= 0xE1) submitState();
+}
+
+void SoftGPU::drawCommand() {
+    const auto prepVramTransfer = [&] {
+        u16 x = args[1] & 0x3ff;
+        u16 y = (args[1] >> 16) & 0x1ff;
+
+        u16 w = args[2] & 0xffff;
+        u16 h = static_cast<u16>(args[2] >> 16);
+
+        w = ((w - 1) & 0x3ff) + 1;
+        h = ((h - 1) & 0x1ff) + 1;
+
+        u32 size = (static_cast<u32>(w * h) + 1) & ~1u;
+        size = size / 2;
+        transferSize = size;
+        writeMode = Transfer;
+        transferRect = {x, y, w, h};
+    };
+
+    switch (command) {
+        case 0x01: break;
+        case 0xA0: prepVramTransfer(); break;
+        case 0xC0: transferToCpu(); break;
+        default: submitCommand(); break;
+    }
+}
+
+void SoftGPU::Rasterizer::execute(u8 opcode, const u32* words) {
+    switch (opcode) {
+        case 0x02: fillRect(words); break;
+        case 0x80: copyRect(words); break;
+        case 0x20: drawPolygon<Polygon::Triangle, Shading::Flat, Transparency::Opaque>(words); break;
+        case 0x22: drawPolygon<Polygon::Triangle, Shading::Flat, Transparency::Transparent>(words); break;
+        case 0x24: drawPolygon<Polygon::Triangle, Shading::TexBlendFlat, Transparency::Opaque>(words); break;
+        case 0x25: drawPolygon<Polygon::Triangle, Shading::RawTex, Transparency::Opaque>(words); break;
+        case 0x26: drawPolygon<Polygon::Triangle, Shading::TexBlendFlat, Transparency::Transparent>(words); break;
+        case 0x27: drawPolygon<Polygon::Triangle, Shading::RawTex, Transparency::Transparent>(words); break;
+        case 0x28:
+        case 0x29: drawPolygon<Polygon::Quad, Shading::Flat, Transparency::Opaque>(words); break;
+        case 0x2A: drawPolygon<Polygon::Quad, Shading::Flat, Transparency::Transparent>(words); break;
+        case 0x2C: drawPolygon<Polygon::Quad, Shading::TexBlendFlat, Transparency::Opaque>(words); break;
+        case 0x2D: drawPolygon<Polygon::Quad, Shading::RawTex, Transparency::Opaque>(words); break;
+        case 0x2E: drawPolygon<Polygon::Quad, Shading::TexBlendFlat, Transparency::Transparent>(words); break;
+        case 0x2F: drawPolygon<Polygon::Quad, Shading::RawTex, Transparency::Transparent>(words); break;
+        case 0x30: drawPolygon<Polygon::Triangle, Shading::Gouraud, Transparency::Opaque>(words); break;
+        case 0x32: drawPolygon<Polygon::Triangle, Shading::Gouraud, Transparency::Transparent>(words); break;
+        case 0x34: drawPolygon<Polygon::Triangle, Shading::TexBlendGouraud, Transparency::Opaque>(words); break;
+        case 0x35: drawPolygon<Polygon::Triangle, Shading::RawTexGouraud, Transparency::Opaque>(words); break;
+        case 0x36: drawPolygon<Polygon::Triangle, Shading::TexBlendGouraud, Transparency::Transparent>(words); break;
+        case 0x37: drawPolygon<Polygon::Triangle, Shading::RawTexGouraud, Transparency::Transparent>(words); break;
+        case 0x38:
+        case 0x39: drawPolygon<Polygon::Quad, Shading::Gouraud, Transparency::Opaque>(words); break;
+        case 0x3A:
+        case 0x3B: drawPolygon<Polygon::Quad, Shading::Gouraud, Transparency::Transparent>(words); break;
+        case 0x3C: drawPolygon<Polygon::Quad, Shading::TexBlendGouraud, Transparency::Opaque>(words); break;
+        case 0x3D: drawPolygon<Polygon::Quad, Shading::RawTexGouraud, Transparency::Opaque>(words); break;
+        case 0x3E: drawPolygon<Polygon::Quad, Shading::TexBlendGouraud, Transparency::Transparent>(words); break;
+        case 0x3F: drawPolygon<Polygon::Quad, Shading::RawTexGouraud, Transparency::Transparent>(words); break;
+        case 0x40: drawLine<Shading::Flat, Transparency::Opaque>(words); break;
+        case 0x42: drawLine<Shading::Flat, Transparency::Transparent>(words); break;
+        case 0x50: drawLine<Shading::Gouraud, Transparency::Opaque>(words); break;
+        case 0x52: drawLine<Shading::Gouraud, Transparency::Transparent>(words); break;
+        case 0x60: drawRect<Rectsize::RectVariable, Transparency::Opaque>(words); break;
+        case 0x62: drawRect<Rectsize::RectVariable, Transparency::Transparent>(words); break;
+        case 0x64: drawRect<Rectsize::RectVariable, Transparency::Opaque, Shading::TexBlendFlat>(words); break;
+        case 0x65: drawRect<Rectsize::RectVariable, Transparency::Opaque, Shading::RawTex>(words); break;
+        case 0x66: drawRect<Rectsize::RectVariable, Transparency::Transparent, Shading::TexBlendFlat>(words); break;
+        case 0x67: drawRect<Rectsize::RectVariable, Transparency::Transparent, Shading::RawTex>(words); break;
+        case 0x68: drawRect<Rectsize::Rect1, Transparency::Opaque>(words); break;
+        case 0x70: drawRect<Rectsize::Rect8, Transparency::Opaque>(words); break;
+        case 0x74: drawRect<Rectsize::Rect8, Transparency::Opaque, Shading::TexBlendFlat>(words); break;
+        case 0x75: drawRect<Rectsize::Rect8, Transparency::Opaque, Shading::RawTex>(words); break;
+        case 0x7C: drawRect<Rectsize::Rect16, Transparency::Opaque, Shading::TexBlendFlat>(words); break;
+        case 0x7D: drawRect<Rectsize::Rect16, Transparency::Opaque, Shading::RawTex>(words); break;
+        case 0x7E: drawRect<Rectsize::Rect16, Transparency::Transparent, Shading::TexBlendFlat>(words); break;
+        case 0x7F: drawRect<Rectsize::Rect16, Transparency::Transparent, Shading::RawTex>(words); break;
+
+        default: Log::debug("Unimplemented GP0 Command {:#02x}\n", opcode);
+    }
+}
+
+SoftGPU::Rasterizer::Vertex SoftGPU::Rasterizer::makeVertex(u32 position, u32 color, u32 uv) const {
+    Vertex vertex;
+    vertex.x = (s32(position) << 21 >> 21) + state.drawOffsetX;
+    vertex.y = (s32(position) << 5 >> 21) + state.drawOffsetY;
+    vertex.r = color & 0xFF;
+    vertex.g = (color >> 8) & 0xFF;
+    vertex.b = (color >> 16) & 0xFF;
+    vertex.u = uv & 0xFF;
+    vertex.v = (uv >> 8) & 0xFF;
+    return vertex;
+}
+
+template <GPU::Polygon polygon, GPU::Shading shading, GPU::Transparency transparency>
+void SoftGPU::Rasterizer::drawPolygon(const u32* words) {
+    using enum Shading;
+
+    constexpr bool textured = shading != Flat && shading != Gouraud;
+    constexpr bool gouraud = shading == Gouraud || shading == TexBlendGouraud || shading == RawTexGouraud;
+    constexpr size_t count = polygon == Polygon::Quad ? 4 : 3;
+    // Every vertex has a position word, gouraud adds a colour before it and textures a uv word after it.
+    // Flat polygons carry their single colour in the command word, so the position always sits at 1 + i * stride
+    constexpr size_t stride = 1 + (gouraud ? 1 : 0) + (textured ? 1 : 0);
+
+    if constexpr (textured) {
+        primClut = static_cast<u16>(words[2] >> 16);
+        primTexpage = (words[2 + stride] >> 16) & 0x3FFF;
+        primBlendMode = (primTexpage >> 5) & 3;
+    } else {
+        primBlendMode = state.semiTrans;
+    }
+
+    Vertex v[count];
+    for (size_t i = 0; i < count; i++) {
+        const u32 color = gouraud ? words[i * stride] : words[0];
+        v[i] = makeVertex(words[1 + i * stride], color, textured ? words[2 + i * stride] : 0);
+    }
+
+    drawTriangle<shading, transparency>(v[0], v[1], v[2]);
+    if constexpr (polygon == Polygon::Quad) {
+        drawTriangle<shading, transparency>(v[1], v[2], v[3]);
+    }
+}
+
+template <GPU::Shading shading, GPU::Transparency transparency>
+void SoftGPU::Rasterizer::drawTriangle(const Vertex& v0, const Vertex& in1, const Vertex& in2) {
+    using enum Shading;
+
+    s64 area = s64(in1.x - v0.x) * (in2.y - v0.y) - s64(in2.x - v0.x) * (in1.y - v0.y);
+    if (area == 0) return;
+
+    // Wind every triangle the same way so inside pixels give positive edge functions
+    const bool flip = area < 0;
+    const Vertex& v1 = flip ? in2 : in1;
+    const Vertex& v2 = flip ? in1 : in2;
+    if (flip) area = -area;
+
+    const s32 minX = std::min({v0.x, v1.x, v2.x});
+    const s32 maxX = std::max({v0.x, v1.x, v2.x});
+    const s32 minY = std::min({v0.y, v1.y, v2.y});
+    const s32 maxY = std::max({v0.y, v1.y, v2.y});
+
+    // The GPU drops polygons spanning more than 1023x511 pixels
+    if (maxX - minX >= VRAM_WIDTH || maxY - minY >= VRAM_HEIGHT) return;
+
+    const s32 left = std::max<s32>(minX, clip.left);
+    const s32 right = std::min<s32>(maxX, clip.right);
+    const s32 top = std::max<s32>(minY, clip.top);
+    const s32 bottom = std::min<s32>(maxY, clip.bottom);
+    if (left > right || top > bottom) return;
+
+    // Edge function of a -> b at p is (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x).
+    // Pixels on right and bottom edges are not drawn, the bias turns those into misses
+    struct Edge {
+        s32 stepX;
+        s32 stepY;
+        s32 row;
+
+        Edge(const Vertex& a, const Vertex& b, s32 x, s32 y) {
+            stepX = a.y - b.y;
+            stepY = b.x - a.x;
+            const bool topLeft = stepX > 0 || (stepX == 0 && stepY > 0);
+            row = stepY * (y - a.y) + stepX * (x - a.x) - (topLeft ? 0 : 1);
+        }
+    };
+
+    Edge e0(v1, v2, left, top);
+    Edge e1(v2, v0, left, top);
+    Edge e2(v0, v1, left, top);
+
+    // Attributes are interpolated as planes over the triangle in 16.16 fixed point
+    struct Attribute {
+        s32 stepX;
+        s32 stepY;
+        s32 row;
+
+        Attribute(s32 a0, s32 a1, s32 a2, const Vertex& v0, const Vertex& v1, const Vertex& v2, s64 area, s32 x, s32 y) {
+            const s64 dx = (s64(a1 - a0) * (v2.y - v0.y) - s64(a2 - a0) * (v1.y - v0.y)) * 65536 / area;
+            const s64 dy = (s64(a2 - a0) * (v1.x - v0.x) - s64(a1 - a0) * (v2.x - v0.x)) * 65536 / area;
+            stepX = static_cast<s32>(dx);
+            stepY = static_cast<s32>(dy);
+            row = static_cast<s32>((s64(a0) << 16) + 0x8000 + dx * (x - v0.x) + dy * (y - v0.y));
+        }
+    };
+
+    constexpr bool textured = shading != Flat && shading != Gouraud;
+    constexpr bool gouraud = shading == Gouraud || shading == TexBlendGouraud;
+    constexpr bool blended = shading == TexBlendFlat || shading == TexBlendGouraud;
+
+    Attribute r(v0.r, v1.r, v2.r, v0, v1, v2, area, left, top);
+    Attribute g(v0.g, v1.g, v2.g, v0, v1, v2, area, left, top);
+    Attribute b(v0.b, v1.b, v2.b, v0, v1, v2, area, left, top);
+    Attribute u(v0.u, v1.u, v2.u, v0, v1, v2, area, left, top);
+    Attribute v(v0.v, v1.v, v2.v, v0, v1, v2, area, left, top);
+
+#ifdef SOFTGPU_SSE2
+    SpanOffsets offsets;
+    for (s32 i = 0; i < 8; i++) {
+        const auto lane = static_cast<size_t>(i);
+        offsets.w0[lane] = e0.stepX * i, offsets.w1[lane] = e1.stepX * i, offsets.w2[lane] = e2.stepX * i;
+        offsets.r[lane] = r.stepX * i, offsets.g[lane] = g.stepX * i, offsets.b[lane] = b.stepX * i;
+        offsets.u[lane] = u.stepX * i, offsets.v[lane] = v.stepX * i;
+    }
+#endif
+
+    const auto rasterize = [&]<bool dithered>() {
+        for (s32 y = top; y <= bottom; y++) {
+            s32 w0 = e0.row, w1 = e1.row, w2 = e2.row;
+            s32 cr = r.row, cg = g.row, cb = b.row, cu = u.row, cv = v.row;
+            s32 x = left;
+
+#ifdef SOFTGPU_SSE2
+            for (; x + 7 <= right; x += 8) {
+                if constexpr (gouraud) {
+                    plotSpan<shading, transparency, dithered>(x, y, {w0, w1, w2, cr, cg, cb, cu, cv}, offsets);
+                } else {
+                    plotSpan<shading, transparency, dithered>(x, y, {w0, w1, w2, v0.r, v0.g, v0.b, cu, cv}, offsets);
+                }
+
+                w0 += e0.stepX * 8, w1 += e1.stepX * 8, w2 += e2.stepX * 8;
+                if constexpr (gouraud) cr += r.stepX * 8, cg += g.stepX * 8, cb += b.stepX * 8;
+                if constexpr (textured) cu += u.stepX * 8, cv += v.stepX * 8;
+            }
+#endif
+
+            // Whatever is left of the row, or all of it without SIMD
+            for (; x <= right; x++) {
+                if ((w0 | w1 | w2) >= 0) {
+                    if constexpr (gouraud) {
+                        plot<shading, transparency, dithered>(x, y, cr >> 16, cg >> 16, cb >> 16, cu >> 16, cv >> 16);
+                    } else {
+                        plot<shading, transparency, dithered>(x, y, v0.r, v0.g, v0.b, cu >> 16, cv >> 16);
+                    }
+                }
+
+                w0 += e0.stepX, w1 += e1.stepX, w2 += e2.stepX;
+                if constexpr (gouraud) cr += r.stepX, cg += g.stepX, cb += b.stepX;
+                if constexpr (textured) cu += u.stepX, cv += v.stepX;
+            }
+
+            e0.row += e0.stepY, e1.row += e1.stepY, e2.row += e2.stepY;
+            r.row += r.stepY, g.row += g.stepY, b.row += b.stepY;
+            u.row += u.stepY, v.row += v.stepY;
+        }
+    };
+
+    // Only shaded or texture blended polygons are dithered
+    if (state.dither && (gouraud || blended)) {
+        rasterize.template operator()<true>();
+    } else {
+        rasterize.template operator()<false>();
+    }
+}
+
+template <GPU::Rectsize size, GPU::Transparency transparency, GPU::Shading shading>
+void SoftGPU::Rasterizer::drawRect(const u32* words) {
+    using enum Rectsize;
+
+    constexpr bool textured = shading != Shading::None;
+
+    s32 width;
+    s32 height;
+
+    if constexpr (size == Rect1) {
+        width = 1;
+        height = 1;
+    } else if constexpr (size == Rect8) {
+        width = 8;
+        height = 8;
+    } else if constexpr (size == Rect16) {
+        width = 16;
+        height = 16;
+    } else if constexpr (size == RectVariable) {
+        // The size follows the uv word on textured rectangles
+        const u32 dimensions = words[textured ? 3 : 2];
+        width = dimensions & 0x3ff;
+        height = (dimensions >> 16) & 0x1ff;
+    }
+
+    const auto origin = makeVertex(words[1], words[0], textured ? words[2] : 0);
+
+    primTexpage = state.rectTexpage;
+    primClut = textured ? static_cast<u16>(words[2] >> 16) : 0;
+    primBlendMode = state.semiTrans;
+
+    // Rectangles are never dithered and may flip their texture coordinates
+    const s32 stepU = state.rectTextureFlipX ? -1 : 1;
+    const s32 stepV = state.rectTextureFlipY ? -1 : 1;
+
+    const s32 firstRow = std::max(0, clip.top - origin.y);
+    const s32 lastRow = std::min(height, clip.bottom - origin.y + 1);
+    const s32 firstCol = std::max(0, clip.left - origin.x);
+    const s32 lastCol = std::min(width, clip.right - origin.x + 1);
+
+    for (s32 row = firstRow; row < lastRow; row++) {
+        const s32 y = origin.y + row;
+        for (s32 col = firstCol; col < lastCol; col++) {
+            const s32 x = origin.x + col;
+
+            if constexpr (textured) {
+                plot<shading, transparency, false>(x, y, origin.r, origin.g, origin.b, origin.u + col * stepU, origin.v + row * stepV);
+            } else {
+                plot<Shading::Flat, transparency, false>(x, y, origin.r, origin.g, origin.b, 0, 0);
+            }
+        }
+    }
+}
+
+template <GPU::Shading shading, GPU::Transparency transparency>
+void SoftGPU::Rasterizer::drawLine(const u32* words) {
+    using enum Shading;
+
+    Vertex p1;
+    Vertex p2;
+
+    if constexpr (shading == Flat) {
+        p1 = makeVertex(words[1], words[0]);
+        p2 = makeVertex(words[2], words[0]);
+    } else {
+        p1 = makeVertex(words[1], words[0]);
+        p2 = makeVertex(words[3], words[2]);
+    }
+
+    primBlendMode = state.semiTrans;
+
+    const s32 dx = p2.x - p1.x;
+    const s32 dy = p2.y - p1.y;
+    if (std::abs(dx) >= VRAM_WIDTH || std::abs(dy) >= VRAM_HEIGHT) return;
+
+    // Walk the major axis one pixel at a time, stepping everything else in 16.16 fixed point
+    const s32 steps = std::max(std::abs(dx), std::abs(dy));
+    const auto step = [steps](s32 from, s32 to) { return steps == 0 ? 0 : ((to - from) << 16) / steps; };
+
+    s32 x = (p1.x << 16) + 0x8000, y = (p1.y << 16) + 0x8000;
+    s32 r = (p1.r << 16) + 0x8000, g = (p1.g << 16) + 0x8000, b = (p1.b << 16) + 0x8000;
+    const s32 stepX = step(p1.x, p2.x), stepY = step(p1.y, p2.y);
+    const s32 stepR = step(p1.r, p2.r), stepG = step(p1.g, p2.g), stepB = step(p1.b, p2.b);
+
+    const auto rasterize = [&]<bool dithered>() {
+        for (s32 i = 0; i <= steps; i++) {
+            const s32 px = x >> 16, py = y >> 16;
+            if (insideClip(px, py)) {
+                plot<Flat, transparency, dithered>(px, py, r >> 16, g >> 16, b >> 16, 0, 0);
+            }
+            x += stepX, y += stepY;
+            r += stepR, g += stepG, b += stepB;
+        }
+    };
+
+    if (state.dither && shading == Gouraud) {
+        rasterize.template operator()<true>();
+    } else {
+        rasterize.template operator()<false>();
+    }
+}
+
+u16 SoftGPU::Rasterizer::sampleTexture(s32 u, s32 v) {
+    u = ((u & 0xFF) & ~state.texWindow.xMask) | (state.texWindow.x & state.texWindow.xMask);
+    v = ((v & 0xFF) & ~state.texWindow.yMask) | (state.texWindow.y & state.texWindow.yMask);
+    if (decodedPage) return decodedPage[v * TextureCache::PAGE_SIZE + u];
+
+    const u32 baseX = (primTexpage & 0xF) * 64;
+    const u32 baseY = ((primTexpage >> 4) & 1) * 256;
+    const u32 clutX = (primClut & 0x3F) * 16;
+    const u32 clutY = (primClut >> 6) & 0x1FF;
+
+    switch ((primTexpage >> 7) & 3) {
+        case T4: {
+            const u16 texel = pixel(baseX + static_cast<u32>(u >> 2), baseY + static_cast<u32>(v));
+            return pixel(clutX + ((texel >> ((u & 3) * 4)) & 0xF), clutY);
+        }
+        case T8: {
+            const u16 texel = pixel(baseX + static_cast<u32>(u >> 1), baseY + static_cast<u32>(v));
+            return pixel(clutX + ((texel >> ((u & 1) * 8)) & 0xFF), clutY);
+        }
+        default: return pixel(baseX + static_cast<u32>(u), baseY + static_cast<u32>(v));
+    }
+}
+
+u16 SoftGPU::Rasterizer::blend(u16 back, u16 front) const {
+    const auto channel = [&](u32 shift) -> u16 {
+        const s32 b = (back >> shift) & 0x1F;
+        const s32 f = (front >> shift) & 0x1F;
+        s32 result;
+        switch (primBlendMode) {
+            case 0: result = (b + f) >> 1; break;
+            case 1: result = b + f; break;
+            case 2: result = b - f; break;
+            default: result = b + (f >> 2); break;
+        }
+        return static_cast<u16>(std::clamp(result, 0, 31) << shift);
+    };
+
+    return channel(0) | channel(5) | channel(10) | (front & 0x8000);
+}
+
+template <GPU::Shading shading, GPU::Transparency transparency, bool dithered>
+void SoftGPU::Rasterizer::plot(s32 x, s32 y, s32 r, s32 g, s32 b, s32 u, s32 v) {
+    using enum Shading;
+
+    constexpr bool textured = shading != Flat && shading != Gouraud && shading != None;
+    constexpr bool raw = shading == RawTex || shading == RawTexGouraud;
+
+    auto& dst = pixel(static_cast<u32>(x), static_cast<u32>(y));
+    if (state.preserveMaskedPixels && (dst & 0x8000)) return;
+
+    u16 color;
+    bool semiTransparent = transparency == Transparency::Transparent;
+
+    if constexpr (textured) {
+        const u16 texel = sampleTexture(u, v);
+        if (texel == 0) return;  // Fully transparent texel
+
+        // Only texels with bit 15 set take part in semi-transparency
+        semiTransparent = semiTransparent && (texel & 0x8000);
+
+        if constexpr (raw) {
+            color = texel;
+        } else {
+            // Texel * colour / 128, with 128 being the neutral colour, done at 8 bit precision before dithering
+            r = ((texel & 0x1F) << 3) * r >> 7;
+            g = (((texel >> 5) & 0x1F) << 3) * g >> 7;
+            b = (((texel >> 10) & 0x1F) << 3) * b >> 7;
+        }
+
+        if constexpr (!raw) {
+            if constexpr (dithered) {
+                const s32 offset = ditherTable[y & 3][x & 3];
+                r += offset, g += offset, b += offset;
+            }
+            color = static_cast<u16>((std::clamp(r, 0, 255) >> 3) | ((std::clamp(g, 0, 255) >> 3) << 5) | ((std::clamp(b, 0, 255) >> 3) << 10));
+            color |= texel & 0x8000;
+        }
+    } else {
+        if constexpr (dithered) {
+            const s32 offset = ditherTable[y & 3][x & 3];
+            r += offset, g += offset, b += offset;
+        }
+        color = static_cast<u16>((std::clamp(r, 0, 255) >> 3) | ((std::clamp(g, 0, 255) >> 3) << 5) | ((std::clamp(b, 0, 255) >> 3) << 10));
+    }
+
+    if (semiTransparent) color = blend(dst, color);
+    dst = color | (state.setMaskBit ? 0x8000 : 0);
+}
+
+#ifdef SOFTGPU_SSE2
+template <GPU::Shading shading, GPU::Transparency transparency, bool dithered>
+void SoftGPU::Rasterizer::plotSpan(s32 x, s32 y, const SpanStart& start, const SpanOffsets& offsets) {
+    using enum Shading;
+
+    constexpr bool textured = shading != Flat && shading != Gouraud && shading != None;
+    constexpr bool raw = shading == RawTex || shading == RawTexGouraud;
+    constexpr bool gouraud = shading == Gouraud || shading == TexBlendGouraud;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i channelMask = _mm_set1_epi16(0x1F);
+    const __m128i maskBit = _mm_set1_epi16(static_cast<s16>(0x8000));
+
+    // A value at the first pixel plus its per lane offsets, as two vectors of 4 lanes
+    const auto spread = [](s32 value, const std::array<s32, 8>& offset) {
+        const __m128i base = _mm_set1_epi32(value);
+        return std::pair{_mm_add_epi32(base, _mm_load_si128(reinterpret_cast<const __m128i*>(offset.data()))),
+                         _mm_add_epi32(base, _mm_load_si128(reinterpret_cast<const __m128i*>(offset.data() + 4)))};
+    };
+    // Integer part of a 16.16 attribute for all 8 lanes, saturated to 16 bits
+    const auto integer = [&](s32 value, const std::array<s32, 8>& offset) {
+        const auto [low, high] = spread(value, offset);
+        return _mm_packs_epi32(_mm_srai_epi32(low, 16), _mm_srai_epi32(high, 16));
+    };
+
+    // Inside pixels have all three edge functions non-negative, packing keeps the sign
+    const auto [w0Low, w0High] = spread(start.w0, offsets.w0);
+    const auto [w1Low, w1High] = spread(start.w1, offsets.w1);
+    const auto [w2Low, w2High] = spread(start.w2, offsets.w2);
+    const __m128i edges = _mm_packs_epi32(_mm_or_si128(_mm_or_si128(w0Low, w1Low), w2Low), _mm_or_si128(_mm_or_si128(w0High, w1High), w2High));
+    __m128i write = _mm_cmpgt_epi16(edges, _mm_set1_epi16(-1));
+    if (_mm_movemask_epi8(write) == 0) return;
+
+    u16* dst = &vram[static_cast<size_t>(y) * VRAM_WIDTH + static_cast<size_t>(x)];
+    const __m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst));
+    if (state.preserveMaskedPixels) write = _mm_andnot_si128(_mm_srai_epi16(back, 15), write);
+
+    __m128i semiTransparent = transparency == Transparency::Transparent ? _mm_cmpeq_epi16(zero, zero) : zero;
+
+    __m128i r = gouraud ? integer(start.r, offsets.r) : _mm_set1_epi16(static_cast<s16>(start.r));
+    __m128i g = gouraud ? integer(start.g, offsets.g) : _mm_set1_epi16(static_cast<s16>(start.g));
+    __m128i b = gouraud ? integer(start.b, offsets.b) : _mm_set1_epi16(static_cast<s16>(start.b));
+
+    __m128i texel = zero;
+    if constexpr (textured) {
+        // Texture lookups are a gather, only covered lanes are sampled
+        alignas(16) std::array<s32, 8> us;
+        alignas(16) std::array<s32, 8> vs;
+        const auto [uLow, uHigh] = spread(start.u, offsets.u);
+        const auto [vLow, vHigh] = spread(start.v, offsets.v);
+        _mm_store_si128(reinterpret_cast<__m128i*>(us.data()), _mm_srai_epi32(uLow, 16));
+        _mm_store_si128(reinterpret_cast<__m128i*>(us.data() + 4), _mm_srai_epi32(uHigh, 16));
+        _mm_store_si128(reinterpret_cast<__m128i*>(vs.data()), _mm_srai_epi32(vLow, 16));
+        _mm_store_si128(reinterpret_cast<__m128i*>(vs.data() + 4), _mm_srai_epi32(vHigh, 16));
+
+        alignas(16) std::array<u16, 8> texels{};
+        const int covered = _mm_movemask_epi8(write);
+        for (size_t lane = 0; lane < texels.size(); lane++) {
+            if (covered & (1 << (lane * 2))) texels[lane] = sampleTexture(us[lane], vs[lane]);
+        }
+        texel = _mm_load_si128(reinterpret_cast<const __m128i*>(texels.data()));
+
+        // Fully transparent texels are skipped, only texels with bit 15 set take part in semi-transparency
+        write = _mm_andnot_si128(_mm_cmpeq_epi16(texel, zero), write);
+        semiTransparent = _mm_and_si128(semiTransparent, _mm_srai_epi16(texel, 15));
+
+        if constexpr (!raw) {
+            // Texel * colour / 128 at 8 bit precision. Colours only leave 0-255 by interpolation rounding, negative ones
+            // would give 0 after the clamp below anyway
+            const auto modulate = [&](__m128i channel, __m128i colour) {
+                colour = _mm_min_epi16(_mm_max_epi16(colour, zero), _mm_set1_epi16(256));
+                return _mm_srli_epi16(_mm_mullo_epi16(_mm_slli_epi16(_mm_and_si128(channel, channelMask), 3), colour), 7);
+            };
+            r = modulate(texel, r);
+            g = modulate(_mm_srli_epi16(texel, 5), g);
+            b = modulate(_mm_srli_epi16(texel, 10), b);
+        }
+    }
+
+    __m128i color;
+    if constexpr (raw) {
+        color = texel;
+    } else {
+        if constexpr (dithered) {
+            const s32* row = ditherTable[y & 3];
+            const __m128i offset = _mm_setr_epi16(static_cast<s16>(row[x & 3]), static_cast<s16>(row[(x + 1) & 3]), static_cast<s16>(row[(x + 2) & 3]),
+                                                  static_cast<s16>(row[(x + 3) & 3]), static_cast<s16>(row[x & 3]), static_cast<s16>(row[(x + 1) & 3]),
+                                                  static_cast<s16>(row[(x + 2) & 3]), static_cast<s16>(row[(x + 3) & 3]));
+            r = _mm_add_epi16(r, offset), g = _mm_add_epi16(g, offset), b = _mm_add_epi16(b, offset);
+        }
+        const auto to5 = [&](__m128i channel) { return _mm_srli_epi16(_mm_min_epi16(_mm_max_epi16(channel, zero), _mm_set1_epi16(255)), 3); };
+        color = _mm_or_si128(_mm_or_si128(to5(r), _mm_slli_epi16(to5(g), 5)), _mm_slli_epi16(to5(b), 10));
+        if constexpr (textured) color = _mm_or_si128(color, _mm_and_si128(texel, maskBit));
+    }
+
+    if (_mm_movemask_epi8(_mm_and_si128(semiTransparent, write)) != 0) {
+        const auto mix = [&](int shift) {
+            const __m128i bg = _mm_and_si128(_mm_srli_epi16(back, shift), channelMask);
+            const __m128i fg = _mm_and_si128(_mm_srli_epi16(color, shift), channelMask);
+            __m128i result;
+            switch (primBlendMode) {
+                case 0: result = _mm_srli_epi16(_mm_add_epi16(bg, fg), 1); break;
+                case 1: result = _mm_min_epi16(_mm_add_epi16(bg, fg), channelMask); break;
+                case 2: result = _mm_max_epi16(_mm_sub_epi16(bg, fg), zero); break;
+                default: result = _mm_min_epi16(_mm_add_epi16(bg, _mm_srli_epi16(fg, 2)), channelMask); break;
+            }
+            return _mm_slli_epi16(result, shift);
+        };
+        const __m128i blended = _mm_or_si128(_mm_or_si128(mix(0), mix(5)), _mm_or_si128(mix(10), _mm_and_si128(color, maskBit)));
+        color = _mm_or_si128(_mm_and_si128(semiTransparent, blended), _mm_andnot_si128(semiTransparent, color));
+    }
+
+    if (state.setMaskBit) color = _mm_or_si128(color, maskBit);
+    const __m128i result = _mm_or_si128(_mm_and_si128(write, color), _mm_andnot_si128(write, back));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), result);
+}
+#endif
+
+void SoftGPU::Rasterizer::writePixel(u32 x, u32 y, u16 value) {
+    auto& dst = pixel(x, y);
+    if (state.preserveMaskedPixels && (dst & 0x8000)) return;
+    dst = value | (state.setMaskBit ? 0x8000 : 0);
+}
+
+void SoftGPU::Rasterizer::fillRect(const u32* words) {
+    // Fills ignore the draw area and mask settings, coordinates are in 16 pixel steps horizontally
+    const u16 color = static_cast<u16>(((words[0] >> 3) & 0x1F) | (((words[0] >> 11) & 0x1F) << 5) | (((words[0] >> 19) & 0x1F) << 10));
+    const u32 x = words[1] & 0x3F0;
+    const u32 y = (words[1] >> 16) & 0x1FF;
+    const u32 w = ((words[2] & 0x3FF) + 0xF) & ~0xFu;
+    const u32 h = (words[2] >> 16) & 0x1FF;
+
+    for (u32 row = 0; row < h; row++) {
+        for (u32 col = 0; col < w; col++) {
+            pixel(x + col, y + row) = color;
+        }
+    }
+}
+
+void SoftGPU::transferToVram() {
+    auto& header = ring.acquire();
+    header.type = PacketType::Upload;
+    header.words[0] = transferRect.x;
+    header.words[1] = transferRect.y;
+    header.words[2] = transferRect.w;
+    header.words[3] = transferRect.h;
+    ring.publish();
+
+    // The data is streamed in chunks, each pair of pixels arrives as one word
+    for (size_t offset = 0; offset < transferWriteBuffer.size();) {
+        auto& packet = ring.acquire();
+        const auto count = std::min(transferWriteBuffer.size() - offset, packet.words.size());
+        packet.type = PacketType::UploadData;
+        packet.length = static_cast<u8>(count);
+        std::copy_n(transferWriteBuffer.begin() + static_cast<std::ptrdiff_t>(offset), count, packet.words.begin());
+        ring.publish();
+        offset += count;
+    }
+    transferWriteBuffer.clear();
+}
+
+void SoftGPU::uploadData(const u32* words, u32 count) {
+    const u32 pixels = u32(uploadRect.w) * uploadRect.h;
+    Rasterizer rasterizer(vram, state, clampToVram(state.drawArea));
+    for (u32 i = 0; i < count * 2 && uploadIndex < pixels; i++, uploadIndex++) {
+        const u16 value = static_cast<u16>(words[i / 2] >> ((i & 1) * 16));
+        rasterizer.writePixel(uploadRect.x + uploadIndex % uploadRect.w, uploadRect.y + uploadIndex / uploadRect.w, value);
+    }
+}
+
+void SoftGPU::transferToCpu() {
+    readMode = GP0Mode::Transfer;
+
+    u16 x = args[1] & 0x3ff;
+    u16 y = (args[1] >> 16) & 0x1ff;
+
+    u16 w = args[2] & 0xffff;
+    u16 h = static_cast<u16>(args[2] >> 16);
+
+    w = ((w - 1) & 0x3ff) + 1;
+    h = ((h - 1) & 0x1ff) + 1;
+
+    // If the transfer size (width * height) is odd,
+    // add 1 more transfer word to make it even
+    u32 size = (static_cast<u32>(w * h) + 1) & ~1u;
+    transferSize = size / 2;
+    transferIndex = 0;
+
+    transferRect = {x, y, w, h};
+
+    // Everything queued before the readback has to land in vram first
+    flush();
+    auto* data = reinterpret_cast<u16*>(transferReadBuffer.data());
+    for (u32 row = 0; row < h; row++) {
+        for (u32 col = 0; col < w; col++) {
+            *data++ = vram[((y + row) & (VRAM_HEIGHT - 1)) * VRAM_WIDTH + ((x + col) & (VRAM_WIDTH - 1))];
+        }
+    }
+    if ((w * h) & 1) *data = 0;
+}
+
+void SoftGPU::TransferVramToVram() { submitCommand(); }
+
+void SoftGPU::Rasterizer::copyRect(const u32* words) {
+    u32 src = words[1];
+    u32 dst = words[2];
+    u32 res = words[3];
+
+    u32 srcX = src & 0x3ff;
+    u32 srcY = (src >> 16) & 0x1ff;
+    u32 dstX = dst & 0x3ff;
+    u32 dstY = (dst >> 16) & 0x1ff;
+
+    u32 width = res & 0xFFFF;
+    u32 height = res >> 16;
+
+    width = ((width - 1) & 0x3ff) + 1;
+    height = ((height - 1) & 0x1ff) + 1;
+
+    for (u32 row = 0; row < height; row++) {
+        for (u32 col = 0; col < width; col++) {
+            writePixel(dstX + col, dstY + row, pixel(srcX + col, srcY + row));
+        }
+    }
+}
+
+void SoftGPU::setDrawMode(u32 value) {
+    drawMode = static_cast<u16>(value);
+    texPageX = value & 0xF;
+    texPageY = (value >> 4) & 0x1;
+    semiTrans = (value >> 5) & 3;
+
+    textureDepth = static_cast<TextureDepth>((value >> 7) & 3);
+    dither = Helpers::isBitSet(value, 9);
+    drawToDisplay = Helpers::isBitSet(value, 10);
+    textureDisable = Helpers::isBitSet(value, 11);
+    rectTextureFlipX = Helpers::isBitSet(value, 12);
+    rectTextureFlipY = Helpers::isBitSet(value, 13);
+    rectTexpage = value & 0x3fff;
+}
+
+void SoftGPU::setTextureWindow(u32 value) {
+    // 8 pixel steps - multiply by 8
+    texWindow.xMask = (value & 0x1F) * 8;
+    texWindow.yMask = ((value >> 5) & 0x1F) * 8;
+    texWindow.x = ((value >> 10) & 0x1F) * 8;
+    texWindow.y = ((value >> 15) & 0x1F) * 8;
+}
+
+void SoftGPU::setDrawOffset(u32 value) {
+    drawOffset.x() = static_cast<s16>((s32)value << 21 >> 21);
+    drawOffset.y() = static_cast<s16>((s32)value << 10 >> 21);
+}
+
+void SoftGPU::setDrawAreaTopLeft(u32 value) {
+    drawArea.top = (value >> 10) & 0x3FF;
+    drawArea.left = value & 0x3FF;
+}
+
+void SoftGPU::setDrawAreaBottomRight(u32 value) {
+    drawArea.bottom = (value >> 10) & 0x3FF;
+    drawArea.right = value & 0x3FF;
+}
+
+void SoftGPU::setMaskBitSetting(u32 value) {
+    setMaskBit = Helpers::isBitSet(value, 0);
+    preserveMaskedPixels = Helpers::isBitSet(value, 1);
+}
+
 }  // namespace GPU
@@ -1,18 +1,193 @@
 #pragma once
+#include <array>
+#include <bitset>
+#include <thread>
+
 #include "gpu.hpp"
+#include "texturecache.hpp"
+#include "support/ringbuffer.hpp"
+#include "support/threadpool.hpp"
 
 namespace GPU {
 
+// CPU side backend writing straight into the vram vector, needs no window or GL context.
+// Decoded GP0 commands are queued to a render thread, the emulation thread only waits on it for VRAM readbacks.
 class SoftGPU : public GPU {
   public:
+    SoftGPU(Scheduler::Scheduler& events);
+    ~SoftGPU() override;
+
     void reset() override;
     void init();
+    void flush() override;
+    void vblank() override;
 
     void drawCommand() override;
     void internalCommand(u32 value) override;
     void transferToVram() override;
     void transferToCpu() override;
     void TransferVramToVram() override;
+
+  private:
+    // GP0 state the rasterizer depends on, a copy is queued every time the draw environment changes
+    struct RenderState {
+        DrawArea drawArea;
+        TextureWindow texWindow;
+        s16 drawOffsetX;
+        s16 drawOffsetY;
+        u16 rectTexpage;
+        u8 semiTrans;
+        bool dither;
+        bool setMaskBit;
+        bool preserveMaskedPixels;
+        bool rectTextureFlipX;
+        bool rectTextureFlipY;
+    };
+
+    enum class PacketType : u8 { Command, State, Upload, UploadData, Sync, Quit };
+
+    struct Packet {
+        PacketType type;
+        u8 command;
+        u8 length;
+        RenderState state;
+        std::array<u32, 16> words;  // Command arguments, the upload rectangle or a chunk of upload data
+    };
+
+    RingBuffer<Packet, 1024> ring;
+    std::thread renderThread;
+
+    // Primitives are binned into square tiles of VRAM, each tile is rasterized by one thread in submission order
+    static constexpr int TILE_SIZE = 32;
+    static constexpr int TILES_X = VRAM_WIDTH / TILE_SIZE;
+    static constexpr int TILES_Y = VRAM_HEIGHT / TILE_SIZE;
+    static constexpr int TILE_COUNT = TILES_X * TILES_Y;
+    static constexpr size_t MAX_BATCH_SIZE = 4096;
+
+    using TileMask = std::bitset<TILE_COUNT>;
+
+    // Draws a single command into vram, clipped to the draw area and an optional tile
+    class Rasterizer {
+      public:
+        Rasterizer(std::vector<u16>& target, const RenderState& renderState, const DrawArea& clipArea, const u16* page = nullptr)
+            : vram(target), state(renderState), clip(clipArea), decodedPage(page) {}
+
+        void execute(u8 opcode, const u32* words);
+        void fillRect(const u32* words);
+        void copyRect(const u32* words);
+        void writePixel(u32 x, u32 y, u16 value);
+
+      private:
+        struct Vertex {
+            s32 x;
+            s32 y;
+            s32 r;
+            s32 g;
+            s32 b;
+            s32 u;
+            s32 v;
+        };
+
+        // Per lane offsets of the edge functions and 16.16 attributes across the 8 pixels the SIMD path shades at once
+        struct SpanOffsets {
+            alignas(16) std::array<s32, 8> w0;
+            alignas(16) std::array<s32, 8> w1;
+            alignas(16) std::array<s32, 8> w2;
+            alignas(16) std::array<s32, 8> r;
+            alignas(16) std::array<s32, 8> g;
+            alignas(16) std::array<s32, 8> b;
+            alignas(16) std::array<s32, 8> u;
+            alignas(16) std::array<s32, 8> v;
+        };
+
+        // Values at the first pixel of a group. Colours are plain 8 bit values unless the primitive is gouraud shaded
+        struct SpanStart {
+            s32 w0;
+            s32 w1;
+            s32 w2;
+            s32 r;
+            s32 g;
+            s32 b;
+            s32 u;
+            s32 v;
+        };
+
+        std::vector<u16>& vram;
+        const RenderState& state;
+        DrawArea clip;  // Inclusive, already limited to VRAM
+        const u16* decodedPage;  // Paletted texture of the command from the texture cache, sampled directly when set
+
+        // Texture and blending state of the primitive being drawn
+        u16 primTexpage = 0;
+        u16 primClut = 0;
+        u32 primBlendMode = 0;
+
+        template <Polygon polygon, Shading shading, Transparency transparency>
+        void drawPolygon(const u32* words);
+
+        template <Rectsize size, Transparency transparency, Shading shading = Shading::None>
+        void drawRect(const u32* words);
+
+        template <Shading shading, Transparency transparency>
+        void drawLine(const u32* words);
+
+        template <Shading shading, Transparency transparency>
+        void drawTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+
+        template <Shading shading, Transparency transparency, bool dithered>
+        void plot(s32 x, s32 y, s32 r, s32 g, s32 b, s32 u, s32 v);
+
+        // Shades the 8 pixels from x on, all inside the clip rectangle. x86-64 only, where SSE2 is always there
+        template <Shading shading, Transparency transparency, bool dithered>
+        void plotSpan(s32 x, s32 y, const SpanStart& start, const SpanOffsets& offsets);
+
+        Vertex makeVertex(u32 position, u32 color, u32 uv = 0) const;
+        [[nodiscard]] bool insideClip(s32 x, s32 y) const { return x >= clip.left && x <= clip.right && y >= clip.top && y <= clip.bottom; }
+        u16 sampleTexture(s32 u, s32 v);
+        u16 blend(u16 back, u16 front) const;
+
+        u16& pixel(u32 x, u32 y) { return vram[(y & (VRAM_HEIGHT - 1)) * VRAM_WIDTH + (x & (VRAM_WIDTH - 1))]; }
+    };
+
+    // Owned by the render thread
+    RenderState state{};
+    Rect<u16> uploadRect;
+    u32 uploadIndex = 0;
+
+    ThreadPool pool;
+    std::vector<Packet> batch;
+    std::vector<const u16*> batchPages;           // Decoded texture page of each batched command, if any
+    std::bitset<TextureCache::SLOTS> batchSlots;  // Texture cache slots sampled by the batch
+    std::array<std::vector<u32>, TILE_COUNT> bins;
+    TileMask batchWrites;  // Tiles drawn to by the batch so far
+    TileMask batchReads;   // Tiles sampled as textures by the batch so far
+
+    TextureCache textureCache;
+    std::vector<u16> decodedPages;
+
+    void renderLoop();
+    void submitCommand();
+    void submitState();
+    void submitSync();
+
+    void queueDraw(const Packet& packet);
+    void flushBatch();
+    void drawSerial(u8 opcode, const u32* words);
+    void uploadData(const u32* words, u32 count);
+
+    [[nodiscard]] bool drawBounds(u8 opcode, const u32* words, DrawArea& bounds) const;
+    [[nodiscard]] bool textureSource(u8 opcode, const u32* words, u16& texpage, u16& clut) const;
+    [[nodiscard]] bool textureReads(u8 opcode, const u32* words, TileMask& tiles) const;
+    [[nodiscard]] DirtyTracker::Mask serialWrites(u8 opcode, const u32* words) const;
+    const u16* decodedPage(u8 opcode, const u32* words);
+    static void markTiles(TileMask& tiles, s32 x, s32 y, s32 width, s32 height);
+
+    void setDrawMode(u32 value) override;
+    void setTextureWindow(u32 value) override;
+    void setDrawOffset(u32 value) override;
+    void setDrawAreaTopLeft(u32 value) override;
+    void setDrawAreaBottomRight(u32 value) override;
+    void setMaskBitSetting(u32 value) override;
 };
 
 }  // namespace GPU
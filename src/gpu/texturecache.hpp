@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <unordered_map>
+
+#include "dirtytracker.hpp"
+
+namespace GPU {
+
+// Bookkeeping for 4bpp and 8bpp texture pages decoded to direct colour, keyed by page position, depth and CLUT.
+// The renderer owns the decoded texels, this only hands out slots and forgets entries once VRAM under their source changes.
+class TextureCache {
+  public:
+    static constexpr int SLOTS = 64;
+    static constexpr int PAGE_SIZE = 256;
+
+    [[nodiscard]] static bool cacheable(u16 texpage) { return ((texpage >> 7) & 3) < 2; }
+
+    // Slot holding the decoded page. On a miss the least recently used slot is handed out and `decode` is set,
+    // the caller has to fill it before drawing with it
+    size_t lookup(u16 texpage, u16 clut, bool& decode) {
+        const auto key = makeKey(texpage, clut);
+        useCounter++;
+
+        if (const auto it = slots.find(key); it != slots.end()) {
+            entries[it->second].lastUse = useCounter;
+            decode = false;
+            return it->second;
+        }
+
+        size_t slot = 0;
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].lastUse < entries[slot].lastUse) slot = i;
+        }
+
+        auto& entry = entries[slot];
+        if (entry.valid) slots.erase(entry.key);
+        entry = {key, useCounter, DirtyTracker::textureTiles(texpage, clut), true};
+        slots[key] = slot;
+        sources |= entry.sources;
+
+        decode = true;
+        return slot;
+    }
+
+    // Drops every entry decoded from any of the given tiles
+    void invalidate(const DirtyTracker::Mask& tiles) {
+        if ((sources & tiles).none()) return;
+
+        sources.reset();
+        for (auto& entry : entries) {
+            if (!entry.valid) continue;
+            if ((entry.sources & tiles).any()) {
+                slots.erase(entry.key);
+                entry.valid = false;
+                entry.lastUse = 0;
+            } else {
+                sources |= entry.sources;
+            }
+        }
+    }
+
+    void clear() {
+        slots.clear();
+        entries = {};
+        sources.reset();
+        useCounter = 0;
+    }
+
+    // Decodes a page into PAGE_SIZE x PAGE_SIZE texels, for renderers that keep VRAM in memory
+    static void decode(const u16* vram, u16 texpage, u16 clut, u16* out) {
+        const u32 baseX = (texpage & 0xF) * 64;
+        const u32 baseY = ((texpage >> 4) & 1) * 256;
+        const u32 clutX = (clut & 0x3F) * 16;
+        const u32 clutY = (clut >> 6) & 0x1FF;
+        const bool is4bpp = ((texpage >> 7) & 3) == 0;
+
+        const auto texel = [&](u32 x, u32 y) { return vram[(y & (GPU::VRAM_HEIGHT - 1)) * GPU::VRAM_WIDTH + (x & (GPU::VRAM_WIDTH - 1))]; };
+        for (u32 v = 0; v < PAGE_SIZE; v++) {
+            for (u32 u = 0; u < PAGE_SIZE; u++) {
+                const u16 packed = texel(baseX + (is4bpp ? u >> 2 : u >> 1), baseY + v);
+                const u32 index = is4bpp ? (packed >> ((u & 3) * 4)) & 0xF : (packed >> ((u & 1) * 8)) & 0xFF;
+                *out++ = texel(clutX + index, clutY);
+            }
+        }
+    }
+
+  private:
+    struct Entry {
+        u32 key = 0;
+        u64 lastUse = 0;  // 0 for free slots, so they are reused first
+        DirtyTracker::Mask sources;
+        bool valid = false;
+    };
+
+    // Page X, page Y and depth bits of the texpage next to the CLUT, semi-transparency does not change the texels
+    static u32 makeKey(u16 texpage, u16 clut) { return (u32(texpage & 0x19F) << 16) | clut; }
+
+    std::array<Entry, SLOTS> entries{};
+    std::unordered_map<u32, size_t> slots;
+    DirtyTracker::Mask sources;  // Union of the sources of every valid entry
+    u64 useCounter = 0;
+};
+
+}  // namespace GPU
@@ -1,15 +1,35 @@
 #include "psx.hpp"
 
+#include <chrono>
 #include <fstream>
 
 #include "glad/gl.h"
 
 #define OPENGL_SHADER_VERSION "#version 410 core\n"
 
-PSX::PSX()
-    : bus(cpu, dma, timers, cdrom, sio, gpu, spu), cpu(bus), scheduler(bus, cpu), dma(bus, scheduler), timers(scheduler), gpu(scheduler),
-      cdrom(scheduler), sio(scheduler) {
+static std::unique_ptr<GPU::GPU> createGPU(const PSX::Config& config, Scheduler::Scheduler& scheduler) {
+    if (config.headless) return std::make_unique<GPU::SoftGPU>(scheduler);
+    return std::make_unique<GPU::GPU_GL>(scheduler, config.resolutionScale);
+}
+
+PSX::PSX() : PSX(Config{}) {}
+
+PSX::PSX(const Config& settings)
+    : config(settings), scheduler(bus, cpu), gpu(createGPU(settings, scheduler)), bus(cpu, dma, timers, cdrom, sio, *gpu, spu), cpu(bus),
+      dma(bus, scheduler), timers(scheduler), cdrom(scheduler), sio(scheduler), pacing(settings.pacing), heldPacing(settings.pacing) {
+    cpu.setLockstep(config.lockstep);
+    if (!config.headless) {
+        gpuGL = static_cast<GPU::GPU_GL*>(gpu.get());
+        if (config.headlessGL) {
+            initHeadlessGL();
+        } else {
+            initVideo();
+        }
+    }
+    reset();
+}
 
+void PSX::initVideo() {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
         Helpers::panic("Error initializing SDL: {}", SDL_GetError());
     }
@@ -25,6 +45,34 @@ PSX::PSX()
         Helpers::panic("Error creating SDL Window: {}", SDL_GetError());
     }
 
+    // The emulation thread renders into a context on a hidden window of its own, so vsync on the real one never blocks it
+    emulationWindow = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (emulationWindow == nullptr) {
+        Helpers::panic("Error creating SDL Window: {}", SDL_GetError());
+    }
+
+    emulationContext = SDL_GL_CreateContext(emulationWindow);
+    if (emulationContext == nullptr) {
+        Helpers::panic("Error creating SDL Context: {}", SDL_GetError());
+    }
+
+    if (!gladLoadGL((GLADloadfunc)SDL_GL_GetProcAddress)) {
+        Helpers::panic("Error initializing glad GL Loader: {}", SDL_GetError());
+    }
+
+    gpuGL->init();  // Init GPU after OpenGL is initialized
+
+    for (auto& frame : frames.buffers()) {
+        frame.texture.create(GL_RGBA8, gpuGL->outputWidth(), gpuGL->outputHeight());
+        frame.texture.setFiltering(OpenGL::Linear);
+        frame.framebuffer.create();
+        frame.framebuffer.bind();
+        frame.framebuffer.attachTexture(frame.texture.handle());
+        OpenGL::checkFramebufferStatus();
+    }
+    OpenGL::bindDefaultFramebuffer();
+
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
     glContext = SDL_GL_CreateContext(window);
     if (glContext == nullptr) {
         Helpers::panic("Error creating SDL Context: {}", SDL_GetError());
@@ -33,10 +81,6 @@ PSX::PSX()
     SDL_GL_MakeCurrent(window, glContext);
     SDL_GL_SetSwapInterval(1);  // VSync on by default
 
-    if (!gladLoadGL((GLADloadfunc)SDL_GL_GetProcAddress)) {
-        Helpers::panic("Error initializing glad GL Loader: {}", SDL_GetError());
-    }
-
     static const char* vertexSource = OPENGL_SHADER_VERSION R"(
 		out vec2 TexCoords;
 
@@ -76,21 +120,39 @@ PSX::PSX()
     screenVAO.create();
     screenVBO.create(OpenGL::ArrayBuffer);
 
-    gpu.init();  // Init GPU after OpenGL is initialized
-    reset();
-
     screenShader.use();
     uniformTextureLocation = screenShader.getUniformLocation("screenTexture");
     glUseProgram(0);
 }
 
+void PSX::initHeadlessGL() {
+#ifdef SHITSTATION_EGL
+    headlessContext.create(4, 1);
+    if (!gladLoadGL(OpenGL::HeadlessContext::getProcAddress())) {
+        Helpers::panic("Error initializing glad GL Loader\n");
+    }
+    gpuGL->init();
+#else
+    Helpers::panic("Headless OpenGL rendering needs a build with EGL\n");
+#endif
+}
+
 PSX::~PSX() {
+    if (config.headless) return;
+    if (config.headlessGL) {
+        gpu.reset();  // Its GL objects have to go before the context member does
+        return;
+    }
+    stopEmulation();
     SDL_GL_DeleteContext(glContext);
+    SDL_GL_DeleteContext(emulationContext);
+    SDL_DestroyWindow(emulationWindow);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
 
 void PSX::reset() {
+    stopEmulation();
     frameCounter = 0;
     running = false;
     cpu.reset();
@@ -98,23 +160,23 @@ void PSX::reset() {
     scheduler.reset();
     dma.reset();
     timers.reset();
-    gpu.reset();
+    // GPU_GL state belongs to the emulation context, which is borrowed while the emulation thread is stopped
+    if (emulationContext) SDL_GL_MakeCurrent(emulationWindow, emulationContext);
+    gpu->reset();
+    if (emulationContext) SDL_GL_MakeCurrent(window, glContext);
     cdrom.reset();
     spu.reset();
-    tempScheduleVBlank();  // schedule first vblank until gpu is implemented
 }
 
 void PSX::runFrame() {
     // Run until we hit vblank
-    while (!vblank) {
+    gpu->frameReady = false;
+    while (!gpu->frameReady) {
         auto& cycleTarget = cpu.getCycleTargetRef();
-        auto& totalCycles = cpu.getCycleRef();
         cycleTarget = scheduler.nextEventCycles();
         // cycleTarget can be dynamically updated by the scheduler when new events are added
         // Figure out a cleaner way to handle this
-        while (totalCycles < cycleTarget) {
-            cpu.step();
-        }
+        cpu.run();
         scheduler.handleEvents();
     }
 }
@@ -127,57 +189,164 @@ void PSX::start() {
     }
 
     running = true;
+    if (emulationContext) startEmulation();
 }
 
-void PSX::stop() { running = false; }
+void PSX::stop() {
+    running = false;
+    stopEmulation();
+}
 
-void PSX::tempScheduleVBlank() {
-    scheduler.scheduleEvent(cyclesPerFrame, [&]() {
-        bus.triggerInterrupt(Bus::IRQ::VBLANK);
-        vblank = true;
-        //        Log::debug("VBLANK at {} cycles\n", cpu.getTotalCycles());
-    });
+void PSX::startEmulation() {
+    if (emulationThread.joinable()) return;
+    emulating = true;
+    emulationThread = std::thread(&PSX::emulationLoop, this);
 }
 
-void PSX::update() {
-    auto startTime = SDL_GetTicks();
+bool PSX::stopEmulation() {
+    emulating = false;
+    if (!emulationThread.joinable()) return false;
+    emulationThread.join();
+    return true;
+}
 
-    if (SDL_PollEvent(&event)) {
-        if (event.type == SDL_QUIT) open = false;
-        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(window)) {
-            open = false;
+void PSX::emulationLoop() {
+    using Clock = std::chrono::steady_clock;
+    SDL_GL_MakeCurrent(emulationWindow, emulationContext);
+
+    auto deadline = Clock::now();
+    while (emulating.load(std::memory_order_relaxed)) {
+        {
+            std::scoped_lock lock(inputMutex);
+            for (auto& key : pendingInput) sio.pad.keyCallback(key);
+            pendingInput.clear();
         }
-        if (event.type == SDL_KEYUP || event.type == SDL_KEYDOWN) sio.pad.keyCallback(event.key);
-    }
 
-    if (running) {
-        gpu.setupDrawEnvironment();
+        const auto startCycles = scheduler.cycles();
+        gpuGL->setupDrawEnvironment();
         runFrame();
+        gpu->vblank();
+        publishFrame();
+        frameCounter++;
+
+        const auto mode = pacing.load(std::memory_order_relaxed);
+        if (mode == Pacing::Uncapped) {
+            deadline = Clock::now();
+            continue;
+        }
+
+        // Paced by emulated time, which follows the video mode the game picked
+        const double speed = mode == Pacing::FastForward ? config.fastForwardSpeed : 1.0;
+        const std::chrono::duration<double> frameTime(double(scheduler.cycles() - startCycles) / clockrate / speed);
+        deadline += std::chrono::duration_cast<Clock::duration>(frameTime);
+
+        // After a stall the schedule restarts from now rather than rushing through frames to catch up
+        const auto now = Clock::now();
+        if (deadline < now - std::chrono::milliseconds(100)) {
+            deadline = now;
+        } else {
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+    SDL_GL_MakeCurrent(emulationWindow, nullptr);
+}
+
+void PSX::publishFrame() {
+    auto& frame = frames.writeBuffer();
+    // The presentation thread may still be drawing the texture if it just handed it back
+    if (frame.released) {
+        glWaitSync(frame.released, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.released);
+        frame.released = nullptr;
     }
+    // Published before but replaced before it was ever presented
+    if (frame.ready) glDeleteSync(frame.ready);
 
-    tempScheduleVBlank();
-    vblank = false;
-    gpu.vblank();
+    gpuGL->copyOutput(frame.framebuffer);
+    frame.ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();  // The fence has to reach the GPU before another context can wait on it
+    frames.publish();
+}
 
+void PSX::present() {
+    if (frames.consume()) {
+        auto& frame = frames.readBuffer();
+        glWaitSync(frame.ready, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.ready);
+        frame.ready = nullptr;
+        hasFrame = true;
+        presentedFrames++;
+    }
+
+    OpenGL::setViewport(width, height);
+    OpenGL::setClearColor();
+    OpenGL::clearColor();
+    if (!hasFrame) return;
+
+    auto& frame = frames.readBuffer();
     screenVAO.bind();
     screenVBO.bind();
-    gpu.getTexture().bind();
-    OpenGL::setViewport(width, height);
+    frame.texture.bind();
 
     screenShader.use();
     glUniform1i(uniformTextureLocation, 0);
+    OpenGL::drawArrays(OpenGL::TriangleStrip, 0, 4);
 
-    OpenGL::setClearColor();
-    OpenGL::clearColor();
+    // Covers every draw of this frame so far, the emulation thread waits on it before reusing the texture
+    if (frame.released) glDeleteSync(frame.released);
+    frame.released = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-    OpenGL::drawArrays(OpenGL::TriangleStrip, 0, 4);
+void PSX::update() {
+    if (config.headless || config.headlessGL) {
+        if (running) {
+            if (gpuGL) gpuGL->setupDrawEnvironment();
+            runFrame();
+        }
+        gpu->vblank();
+        frameCounter++;
+        return;
+    }
 
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) open = false;
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE && event.window.windowID == SDL_GetWindowID(window)) {
+            open = false;
+        }
+        if (event.type == SDL_KEYUP || event.type == SDL_KEYDOWN) {
+            if (event.key.keysym.sym == SDLK_TAB) {
+                if (event.key.repeat) continue;
+                if (event.type == SDL_KEYDOWN) {
+                    heldPacing = pacing;
+                    pacing = Pacing::FastForward;
+                } else {
+                    pacing = heldPacing;
+                }
+                continue;
+            }
+            std::scoped_lock lock(inputMutex);
+            pendingInput.push_back(event.key);
+        }
+    }
+
+    present();
     SDL_GL_SwapWindow(window);
 
-    auto endTime = SDL_GetTicks() - startTime;
-    auto currentFPS = (endTime > 0) ? 1000.0f / endTime : 0.0f;
-    frameCounter++;
-    SDL_SetWindowTitle(window, fmt::format(fmt::runtime("ShitStation - {:.2f} FPS/ {:.3f}ms"), currentFPS, float(endTime)).c_str());
+    // Emulated frames and presented frames are counted separately, they only match when the emulator keeps up with the display
+    const auto now = SDL_GetTicks();
+    if (now - statsStart >= 1000) {
+        const float seconds = float(now - statsStart) / 1000.0f;
+        const auto emulated = frameCounter.load();
+        const float emulationFPS = float(emulated - statsFrames) / seconds;
+        const float presentFPS = float(presentedFrames) / seconds;
+        SDL_SetWindowTitle(
+            window, fmt::format(fmt::runtime("ShitStation - {:.2f} FPS / {:.2f} presented"), emulationFPS, presentFPS).c_str()
+        );
+        statsStart = now;
+        statsFrames = emulated;
+        presentedFrames = 0;
+    }
 }
 
 void PSX::loadBIOS(const std::filesystem::path& path) {
@@ -201,11 +370,19 @@ void PSX::loadBIOS(const std::filesystem::path& path) {
 
     file.close();
 
+    // Memory and the block cache belong to the emulation thread while it runs
+    const bool resume = stopEmulation();
     std::memcpy(bus.getBiosPointer(), buffer.data(), buffer.size());
+    cpu.clearBlockCache();
     biosLoaded = true;
+    if (resume) startEmulation();
 }
 
-void PSX::loadDisc(const std::filesystem::path& path) { cdrom.loadDisc(path); }
+void PSX::loadDisc(const std::filesystem::path& path) {
+    const bool resume = stopEmulation();
+    cdrom.loadDisc(path);
+    if (resume) startEmulation();
+}
 
 void PSX::sideload(const std::filesystem::path& path) {
     u32 initialPC = 0;
@@ -246,5 +423,7 @@ void PSX::sideload(const std::filesystem::path& path) {
     file.read(reinterpret_cast<char*>(exe.data()), static_cast<std::streamsize>(size));
     file.close();
 
+    const bool resume = stopEmulation();
     bus.setSideload(address, initialPC, exe);
+    if (resume) startEmulation();
 }
@@ -1,7 +1,12 @@
 #pragma once
 #include <SDL.h>
 
+#include <atomic>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "bus/bus.hpp"
 #include "cdrom/cdrom.hpp"
@@ -16,11 +21,38 @@
 #include "support/helpers.hpp"
 #include "support/log.hpp"
 #include "support/opengl.hpp"
+#include "support/triplebuffer.hpp"
+#ifdef SHITSTATION_EGL
+#include "support/eglcontext.hpp"
+#endif
 #include "timers/timers.hpp"
 
 class PSX {
   public:
+    // How fast the emulation thread runs, presentation always follows the display refresh
+    enum class Pacing {
+        FramePaced,   // Real console speed, derived from the emulated cycles of each frame
+        Uncapped,     // As fast as the host allows
+        FastForward,  // Config::fastForwardSpeed times console speed
+    };
+
+    struct Config {
+        // Skips SDL video and OpenGL entirely and renders with the software GPU, for servers without a display
+        bool headless = false;
+        // Renders with the OpenGL GPU on an offscreen EGL context instead of a window, frames are read back through getVRAM().
+        // Needs a build with EGL, ignored when headless is set
+        bool headlessGL = false;
+        // Internal resolution multiplier for the OpenGL renderer, 1 to 8
+        int resolutionScale = 1;
+        // Windowed mode only, fast-forward is also available while Tab is held
+        Pacing pacing = Pacing::FramePaced;
+        double fastForwardSpeed = 4.0;
+        // Checks every recompiled block against the interpreter and logs mismatches, for debugging the recompiler. Very slow
+        bool lockstep = false;
+    };
+
     PSX();
+    explicit PSX(const Config& settings);
     ~PSX();
 
     void reset();
@@ -29,44 +61,100 @@ class PSX {
     void start();
     void stop();
 
+    // Headless configurations run one frame per call. With a window, emulation runs on its own thread once started and this
+    // handles events and presents the latest finished frame
     void update();
 
     [[nodiscard]] bool isOpen() const { return open; }
 
+    void setPacing(Pacing mode) { pacing = mode; }
+    [[nodiscard]] Pacing getPacing() const { return pacing; }
+
+    // Framebuffer access for library users, kept current by the software GPU and read back from the OpenGL GPU on every call
+    [[nodiscard]] const std::vector<u16>& getVRAM() const {
+        gpu->flush();
+        return gpu->getVRAM();
+    }
+    [[nodiscard]] GPU::DisplayArea getDisplayArea() const { return gpu->getDisplayArea(); }
+    [[nodiscard]] u64 getFrameCount() const { return frameCounter; }
+
     void loadBIOS(const std::filesystem::path& path);
     void loadDisc(const std::filesystem::path& path);
     void sideload(const std::filesystem::path& path);
 
     static constexpr u32 clockrate = 33868800;
-    static constexpr u32 framerate = 60;
     static constexpr u32 width = 1280;
     static constexpr u32 height = 720;
-    static constexpr u32 cyclesPerFrame = clockrate / framerate;
 
   private:
+    void initVideo();
+    void initHeadlessGL();
+
+    void startEmulation();
+    // Returns whether the emulation thread was running
+    bool stopEmulation();
+    void emulationLoop();
+    void publishFrame();
+    void present();
+
+    Config config;
+
+    // Devices register their events from their constructors, so the scheduler comes first
+    Scheduler::Scheduler scheduler;
+
+    // The backend is picked at runtime, it has to exist before the bus takes a reference to it
+    std::unique_ptr<GPU::GPU> gpu;
+    GPU::GPU_GL* gpuGL = nullptr;  // Set when presenting through OpenGL
+
     Bus::Bus bus;
     Cpu::Cpu cpu;
-    Scheduler::Scheduler scheduler;
     DMA::DMA dma;
     Timers::Timers timers;
-    GPU::GPU_GL gpu;
 
     CDROM::CDROM cdrom;
     SIO::SIO sio;
     Spu::Spu spu;
 
     SDL_Renderer* renderer;
-    SDL_Window* window;
+    SDL_Window* window = nullptr;
     SDL_Texture* texture;
-    SDL_GLContext glContext;
+    SDL_GLContext glContext = nullptr;  // Presents frames on the main thread
+    // GPU_GL renders on the emulation thread, into a context of its own that shares textures with glContext
+    SDL_Window* emulationWindow = nullptr;
+    SDL_GLContext emulationContext = nullptr;
     SDL_Event event;
+#ifdef SHITSTATION_EGL
+    OpenGL::HeadlessContext headlessContext;
+#endif
 
     bool running = false;
-    bool vblank = false;
     bool biosLoaded = false;
     bool open = true;
-    void tempScheduleVBlank();
-    u64 frameCounter = 0;
+    std::atomic<u64> frameCounter = 0;
+
+    std::thread emulationThread;
+    std::atomic<bool> emulating = false;
+    std::atomic<Pacing> pacing = Pacing::FramePaced;
+    Pacing heldPacing = Pacing::FramePaced;  // Restored when the fast-forward key is released
+
+    // Key events are applied on the emulation thread at the start of a frame
+    std::mutex inputMutex;
+    std::vector<SDL_KeyboardEvent> pendingInput;
+
+    // Finished frames travel from the emulation thread to the presentation thread through a mailbox of shared textures.
+    // `ready` fences the copy into the texture, `released` the last draw that presented it
+    struct Frame {
+        OpenGL::Texture texture;
+        OpenGL::Framebuffer framebuffer;  // Framebuffer objects are not shared, this one belongs to emulationContext
+        GLsync ready = nullptr;
+        GLsync released = nullptr;
+    };
+    TripleBuffer<Frame> frames;
+    bool hasFrame = false;  // Whether the presentation thread has received a frame yet
+
+    u32 statsStart = 0;
+    u64 statsFrames = 0;
+    u32 presentedFrames = 0;
     OpenGL::ShaderProgram screenShader;
     OpenGL::VertexArray screenVAO;
     OpenGL::VertexBuffer screenVBO;
@@ -5,30 +5,70 @@
 
 namespace Scheduler {
 
-Scheduler::Scheduler(Bus::Bus& bus, Cpu::Cpu& cpu) : bus(bus), cpu(cpu), cycles(cpu.getCycleRef()) { reset(); }
+Scheduler::Scheduler(Bus::Bus& bus, Cpu::Cpu& cpu) : bus(bus), cpu(cpu) { deadlines.fill(NEVER); }
 
-void Scheduler::scheduleEvent(Cycles cycleCount, Callback callback) {
-    events.emplace(cycles + cycleCount, callback);
-    cpu.setCycleTarget(events.top().cycleTarget());
+EventHandle Scheduler::scheduleAt(Event event, Cycles cycleTarget) {
+    setDeadline(event, cycleTarget);
+    return {event, ++generations[index(event)]};
+}
+
+void Scheduler::cancel(Event event) {
+    if (deadlines[index(event)] == NEVER) return;
+    deadlines[index(event)] = NEVER;
+    if (event == nextEvent) updateNextEvent();
+}
+
+bool Scheduler::cancel(const EventHandle& handle) {
+    if (!isPending(handle)) return false;
+    cancel(handle.event);
+    return true;
+}
+
+bool Scheduler::reschedule(const EventHandle& handle, Cycles cycleCount) {
+    if (!isPending(handle)) return false;
+    setDeadline(handle.event, cycles() + cycleCount);
+    return true;
+}
+
+void Scheduler::setDeadline(Event event, Cycles cycleTarget) {
+    deadlines[index(event)] = cycleTarget;
+
+    if (cycleTarget <= nextDeadline) {
+        nextDeadline = cycleTarget;
+        nextEvent = event;
+        cpu.setCycleTarget(nextDeadline);
+    } else if (event == nextEvent) {
+        // The earliest event moved back, another slot might be due first now
+        updateNextEvent();
+    }
 }
 
 void Scheduler::handleEvents() {
-    while (cycles >= events.top().cycleTarget()) {
-        if (events.top().callback != nullptr) events.top().callback();
-        events.pop();
+    while (cycles() >= nextDeadline) {
+        const auto event = nextEvent;
+        // Free the slot before running the handler so it can schedule itself again
+        deadlines[index(event)] = NEVER;
+        updateNextEvent();
+        if (handlers[index(event)]) handlers[index(event)]();
     }
 }
 
 void Scheduler::reset() {
-    clearEvents();
-    scheduleEvent(std::numeric_limits<Cycles>::max(), nullptr);
+    deadlines.fill(NEVER);
+    updateNextEvent();
 }
 
-void Scheduler::scheduleInterrupt(Cycles cycleCount, Bus::IRQ irq) {
-    scheduleEvent(cycleCount, [&, irq]() {
-        bus.triggerInterrupt(irq);
-        //        Log::debug("Interrupt triggered: {}\n", magic_enum::enum_name(irq));
-    });
+void Scheduler::updateNextEvent() {
+    // The table is small and fixed, a linear scan beats maintaining a heap
+    nextDeadline = NEVER;
+    nextEvent = Event::Count;
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        if (deadlines[i] < nextDeadline) {
+            nextDeadline = deadlines[i];
+            nextEvent = static_cast<Event>(i);
+        }
+    }
+    cpu.setCycleTarget(nextDeadline);
 }
 
 }  // namespace Scheduler
@@ -1,6 +1,7 @@
 #pragma once
+#include <array>
 #include <functional>
-#include <queue>
+#include <limits>
 
 #include "bus/bus.hpp"
 #include "cpu/cpu.hpp"
@@ -9,46 +10,77 @@ namespace Scheduler {
 using Cycles = std::uint64_t;
 using Callback = std::function<void()>;
 
-class Event {
-  public:
-    Event(Cycles cycles) : targetCycles(cycles) {}
-    Event(Cycles cycles, Callback callback) : targetCycles(cycles), callback(callback) {}
-    Event() : Event(std::numeric_limits<Cycles>::max()) {}
-
-    bool operator>(const Event& rhs) const { return targetCycles > rhs.targetCycles; }
-    bool operator<(const Event& rhs) const { return targetCycles < rhs.targetCycles; }
-
-    [[nodiscard]] Cycles cycleTarget() const { return targetCycles; }
-    void setCycleTarget(Cycles cycles) { targetCycles = cycles; }
+// Every event source owns exactly one slot, scheduling an event again moves its deadline
+enum class Event : u32 {
+    VBlank,
+    CDROMInterrupt,
+    CDROMRead,
+    CDROMCommandStart,
+    CDROMCommandFinish,
+    SIOInterrupt,
+    Timer0,
+    Timer1,
+    Timer2,
+    DMAInterrupt,
+    Count,
+};
 
-    Cycles targetCycles;
-    Callback callback = nullptr;
+// Refers to one scheduled occurrence of an event. It goes stale once that occurrence fires, is cancelled or the
+// event is scheduled again, stale handles are ignored by cancel() and reschedule()
+struct EventHandle {
+    Event event = Event::Count;
+    u32 generation = 0;
 };
 
 class Scheduler {
   public:
+    static constexpr Cycles NEVER = std::numeric_limits<Cycles>::max();
+
+    // Only binds the references, the bus and CPU may be constructed after the scheduler. reset() before running
     explicit Scheduler(Bus::Bus& bus, Cpu::Cpu& cpu);
 
+    // Drops every pending deadline, registered handlers are kept
     void reset();
 
-    void clearEvents() {
-        while (!events.empty()) {
-            events.pop();
-        }
-    }
+    // Handlers are registered once by the owning device, usually from its constructor
+    void registerEvent(Event event, Callback callback) { handlers[index(event)] = std::move(callback); }
 
-    void scheduleEvent(Cycles cycleCount, Callback callback);
+    EventHandle schedule(Event event, Cycles cycleCount) { return scheduleAt(event, cycles() + cycleCount); }
+    EventHandle scheduleAt(Event event, Cycles cycleTarget);
+    void cancel(Event event);
 
-    void scheduleInterrupt(Cycles cycleCount, Bus::IRQ irq);
+    // Both return false and do nothing if the handle is stale
+    bool cancel(const EventHandle& handle);
+    bool reschedule(const EventHandle& handle, Cycles cycleCount);
+
+    [[nodiscard]] bool isScheduled(Event event) const { return deadlines[index(event)] != NEVER; }
+    [[nodiscard]] bool isPending(const EventHandle& handle) const {
+        return handle.event != Event::Count && isScheduled(handle.event) && generations[index(handle.event)] == handle.generation;
+    }
+    [[nodiscard]] Cycles deadline(Event event) const { return deadlines[index(event)]; }
 
     void handleEvents();
 
-    auto nextEventCycles() { return events.top().cycleTarget(); }
+    [[nodiscard]] Cycles nextEventCycles() const { return nextDeadline; }
+
+    [[nodiscard]] Cycles cycles() const { return cpu.getTotalCycles(); }
 
     Bus::Bus& bus;
     Cpu::Cpu& cpu;
-    Cycles& cycles;
-    std::priority_queue<Event, std::vector<Event>, std::greater<>> events;
+
+  private:
+    static constexpr size_t EVENT_COUNT = static_cast<size_t>(Event::Count);
+
+    static constexpr size_t index(Event event) { return static_cast<size_t>(event); }
+
+    void setDeadline(Event event, Cycles cycleTarget);
+    void updateNextEvent();
+
+    std::array<Callback, EVENT_COUNT> handlers;
+    std::array<Cycles, EVENT_COUNT> deadlines;
+    std::array<u32, EVENT_COUNT> generations = {};
+    Cycles nextDeadline = NEVER;
+    Event nextEvent = Event::Count;
 };
 
 }  // namespace Scheduler
@@ -4,7 +4,14 @@
 
 namespace SIO {
 
-SIO::SIO(Scheduler::Scheduler& scheduler) : pad(*this), m_scheduler(scheduler) { reset(); }
+SIO::SIO(Scheduler::Scheduler& scheduler) : pad(*this), m_scheduler(scheduler) {
+    m_scheduler.registerEvent(Scheduler::Event::SIOInterrupt, [this] {
+        m_regs.stat.IRQ = 0;
+        m_scheduler.bus.triggerInterrupt(Bus::IRQ::PAD);
+        setFifoStatus();
+    });
+    reset();
+}
 
 void SIO::reset() {
     m_regs.control.r = 0;
@@ -18,6 +25,7 @@ void SIO::reset() {
     m_regs.stat.TXReady2 = 1;
     m_regs.stat.FifoNotEmpty = 0;
     m_fifo.clear();
+    m_scheduler.cancel(m_irqEvent);
 }
 
 void SIO::txData(u8 data) {
@@ -112,13 +120,7 @@ void SIO::ack(bool ack) {
     }
 }
 
-void SIO::scheduleIRQ() {
-    m_scheduler.scheduleEvent(1000, [&] {
-        m_regs.stat.IRQ = 0;
-        m_scheduler.bus.triggerInterrupt(Bus::IRQ::PAD);
-        setFifoStatus();
-    });
-}
+void SIO::scheduleIRQ() { m_irqEvent = m_scheduler.schedule(Scheduler::Event::SIOInterrupt, 1000); }
 
 template <typename T>
 T SIO::read(u32 offset) {
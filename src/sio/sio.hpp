@@ -171,6 +171,7 @@ class SIO {
   private:
     friend class Pad;
     Scheduler::Scheduler& m_scheduler;
+    Scheduler::EventHandle m_irqEvent;
 };
 
 }  // namespace SIO
@@ -0,0 +1,82 @@
+#include "eglcontext.hpp"
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+
+#include "support/helpers.hpp"
+
+namespace OpenGL {
+
+static bool hasExtension(const char* extensions, const char* name) {
+    if (extensions == nullptr) return false;
+    const auto length = std::strlen(name);
+    for (const char* found = std::strstr(extensions, name); found; found = std::strstr(found + length, name)) {
+        const char end = found[length];
+        if ((found == extensions || found[-1] == ' ') && (end == ' ' || end == '\0')) return true;
+    }
+    return false;
+}
+
+HeadlessContext::~HeadlessContext() {
+    if (display == nullptr) return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surface) eglDestroySurface(display, surface);
+    if (context) eglDestroyContext(display, context);
+    eglTerminate(display);
+}
+
+void HeadlessContext::create(int major, int minor) {
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    if (hasExtension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless")) {
+        const auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay) eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (eglDisplay == EGL_NO_DISPLAY) eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, nullptr, nullptr)) {
+        Helpers::panic("Error initializing EGL display: {:#x}\n", eglGetError());
+    }
+    display = eglDisplay;
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        Helpers::panic("EGL does not support desktop OpenGL: {:#x}\n", eglGetError());
+    }
+
+    const bool surfaceless = hasExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        Helpers::panic("No suitable EGL config: {:#x}\n", eglGetError());
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major, EGL_CONTEXT_MINOR_VERSION, minor, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    context = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        Helpers::panic("Error creating EGL context: {:#x}\n", eglGetError());
+    }
+
+    // Everything is drawn into framebuffer objects, the surface only exists because some drivers need one to make a context current
+    if (!surfaceless) {
+        const EGLint pbufferAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        surface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttributes);
+        if (surface == EGL_NO_SURFACE) {
+            Helpers::panic("Error creating EGL pbuffer: {:#x}\n", eglGetError());
+        }
+    }
+
+    if (!eglMakeCurrent(eglDisplay, surface, surface, context)) {
+        Helpers::panic("Error making EGL context current: {:#x}\n", eglGetError());
+    }
+}
+
+GLADloadfunc HeadlessContext::getProcAddress() { return reinterpret_cast<GLADloadfunc>(eglGetProcAddress); }
+
+}  // namespace OpenGL
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "glad/gl.h"
+
+namespace OpenGL {
+
+// Offscreen OpenGL context on EGL, for rendering without a window or display server. Prefers Mesa's surfaceless platform
+// and falls back to the default display with a 1x1 pbuffer when surfaceless contexts are not supported
+class HeadlessContext {
+  public:
+    HeadlessContext() = default;
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    // Creates a core profile context of the given version and makes it current, panics on failure
+    void create(int major, int minor);
+
+    static GLADloadfunc getProcAddress();
+
+  private:
+    // EGL handles are kept opaque here so eglplatform.h and the window system headers it may pull in stay out of the includes
+    void* display = nullptr;
+    void* context = nullptr;
+    void* surface = nullptr;
+};
+
+}  // namespace OpenGL
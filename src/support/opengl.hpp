@@ -4,6 +4,7 @@
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "glad/gl.h"
 
@@ -77,12 +78,15 @@ enum Filtering {
 enum BufferTarget {
     ArrayBuffer = GL_ARRAY_BUFFER,
     ElementArrayBuffer = GL_ELEMENT_ARRAY_BUFFER,
+    PixelPackBuffer = GL_PIXEL_PACK_BUFFER,
+    PixelUnpackBuffer = GL_PIXEL_UNPACK_BUFFER,
 };
 
 enum BufferUsage {
     StaticDraw = GL_STATIC_DRAW,
     DynamicDraw = GL_DYNAMIC_DRAW,
     StreamDraw = GL_STREAM_DRAW,
+    StreamRead = GL_STREAM_READ,
 };
 
 enum class ShaderType {
@@ -176,6 +180,13 @@ struct VertexBuffer {
     VertexBuffer() {}
 
     ~VertexBuffer() {
+        for (auto fence : m_fences) {
+            if (fence) glDeleteSync(fence);
+        }
+        if (m_mapped) {
+            bind();
+            glUnmapBuffer(static_cast<GLenum>(m_target));
+        }
         if (m_handle) glDeleteBuffers(1, &m_handle);
     }
 
@@ -193,23 +204,73 @@ struct VertexBuffer {
         glBufferData(static_cast<GLenum>(m_target), size, nullptr, static_cast<GLenum>(usage));
     }
 
+    // Persistently mapped, coherent storage split into `segments` equal parts that are written in turn. Once the CPU moves on
+    // from a segment it is fenced, and it is only handed out again after the GPU is done drawing from it.
+    // Returns false when the driver lacks buffer storage, the buffer is left uncreated so callers can use createFixed instead
+    bool createPersistent(BufferTarget target, GLsizeiptr segmentSize, int segments) {
+        if (!GLAD_GL_ARB_buffer_storage) return false;
+
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &m_handle);
+        m_target = target;
+        bind();
+        glBufferStorage(static_cast<GLenum>(m_target), segmentSize * segments, nullptr, flags);
+        m_mapped = static_cast<GLubyte*>(glMapBufferRange(static_cast<GLenum>(m_target), 0, segmentSize * segments, flags));
+        m_segmentSize = static_cast<size_t>(segmentSize);
+        m_segment = 0;
+        m_fences.assign(static_cast<size_t>(segments), nullptr);
+        return true;
+    }
+
+    [[nodiscard]] bool isPersistent() const { return m_mapped != nullptr; }
+
+    // Mapped memory of the segment currently owned by the CPU
+    template <typename T>
+    T* segmentData() {
+        return reinterpret_cast<T*>(m_mapped + m_segment * m_segmentSize);
+    }
+
+    // Index of the first T in the current segment, relative to the start of the buffer
+    template <typename T>
+    GLint segmentFirst() const {
+        return static_cast<GLint>(m_segment * m_segmentSize / sizeof(T));
+    }
+
+    // Fences the current segment after the draws issued from it and moves to the next one, blocking if the GPU still reads it
+    void nextSegment() {
+        m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_segment = (m_segment + 1) % m_fences.size();
+
+        if (auto& fence = m_fences[m_segment]) {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+
     void bind() { glBindBuffer(static_cast<GLenum>(m_target), m_handle); }
     void unbind() { glBindBuffer(static_cast<GLenum>(m_target), 0); }
 
     template <typename T>
     void data(T* data, int count, BufferUsage usage) {
-        glBufferData(static_cast<GLenum>(m_target), sizeof(T) * count, data, static_cast<GLenum>(usage));
+        glBufferData(static_cast<GLenum>(m_target), static_cast<GLsizeiptr>(sizeof(T)) * count, data, static_cast<GLenum>(usage));
     }
 
     template <typename T>
     void subData(T* data, int count, int offset = 0) {
-        glBufferSubData(static_cast<GLenum>(m_target), offset, sizeof(T) * count, data);
+        glBufferSubData(static_cast<GLenum>(m_target), offset, static_cast<GLsizeiptr>(sizeof(T)) * count, data);
     }
 
     GLuint handle() { return m_handle; }
 
     GLuint m_handle = 0;
     BufferTarget m_target;
+
+    GLubyte* m_mapped = nullptr;
+    size_t m_segmentSize = 0;
+    size_t m_segment = 0;
+    std::vector<GLsync> m_fences;
 };
 
 struct VertexArray {
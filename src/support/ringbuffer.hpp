@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+// Lock-free queue between exactly one producer thread and one consumer thread.
+// Slots are filled and drained in place, the producer writes into acquire()/publish() and the consumer reads from front()/pop().
+template <typename T, size_t Size>
+class RingBuffer {
+    static_assert((Size & (Size - 1)) == 0, "RingBuffer size must be a power of two");
+
+  public:
+    RingBuffer() = default;
+
+    // Disable copies
+    RingBuffer(const RingBuffer<T, Size>&) = delete;
+    RingBuffer& operator=(const RingBuffer<T, Size>&) = delete;
+
+    // Producer: returns the next free slot, yielding while the consumer catches up
+    T& acquire() {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        while (head - m_tail.load(std::memory_order_acquire) == Size) std::this_thread::yield();
+        return m_buffer[head & (Size - 1)];
+    }
+
+    // Producer: makes the slot returned by acquire() visible to the consumer
+    void publish() {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_head.notify_one();
+    }
+
+    // Producer: blocks until the consumer has popped everything published so far
+    void waitUntilEmpty() {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        for (auto tail = m_tail.load(std::memory_order_acquire); tail != head; tail = m_tail.load(std::memory_order_acquire)) {
+            m_tail.wait(tail, std::memory_order_acquire);
+        }
+    }
+
+    // Consumer: blocks until a slot is published and returns it, the slot stays valid until pop()
+    T& front() {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        m_head.wait(tail, std::memory_order_acquire);
+        return m_buffer[tail & (Size - 1)];
+    }
+
+    // Consumer: releases the slot returned by front() back to the producer
+    void pop() {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_tail.notify_one();
+    }
+
+    [[nodiscard]] bool empty() const { return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire); }
+
+  private:
+    // Kept on separate cache lines so the two threads do not false share
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+    alignas(64) std::array<T, Size> m_buffer;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running parallel loops. Every participant owns a deque of job indices, works through its own
+// from the back and steals from the front of the others once it runs dry, so uneven jobs still spread across all threads.
+class ThreadPool {
+  public:
+    // The thread calling parallelFor() takes part in the work, so a pool of N threads only spawns N - 1 workers
+    explicit ThreadPool(size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; i++) m_queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 1; i < threads; i++) m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ~ThreadPool() {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers) worker.join();
+    }
+
+    // Disable copies
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] size_t size() const { return m_queues.size(); }
+
+    // Runs job(i) for every i in [0, count) and returns once all of them have finished. Not reentrant.
+    void parallelFor(size_t count, const std::function<void(size_t)>& job) {
+        if (count == 0) return;
+
+        m_job = &job;
+        m_remaining.store(count, std::memory_order_relaxed);
+
+        // Hand out contiguous ranges, neighbouring jobs tend to touch neighbouring data
+        for (size_t i = 0; i < m_queues.size(); i++) {
+            auto& queue = *m_queues[i];
+            std::scoped_lock lock(queue.mutex);
+            for (size_t index = i * count / m_queues.size(); index < (i + 1) * count / m_queues.size(); index++) {
+                queue.jobs.push_back(index);
+            }
+        }
+
+        {
+            std::scoped_lock lock(m_mutex);
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        while (runOne(0)) {
+        }
+        // Stolen jobs may still be running on other threads
+        for (auto left = m_remaining.load(std::memory_order_acquire); left != 0; left = m_remaining.load(std::memory_order_acquire)) {
+            m_remaining.wait(left, std::memory_order_acquire);
+        }
+        m_job = nullptr;
+    }
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    size_t m_generation = 0;
+    bool m_quit = false;
+
+    const std::function<void(size_t)>* m_job = nullptr;
+    std::atomic<size_t> m_remaining = 0;
+
+    // Runs a single job from our own queue or one stolen from another participant, false once every queue is empty
+    bool runOne(size_t self) {
+        std::optional<size_t> index;
+        {
+            auto& queue = *m_queues[self];
+            std::scoped_lock lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                index = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+        }
+
+        for (size_t i = 1; i < m_queues.size() && !index; i++) {
+            auto& victim = *m_queues[(self + i) % m_queues.size()];
+            std::scoped_lock lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                index = victim.jobs.front();
+                victim.jobs.pop_front();
+            }
+        }
+
+        if (!index) return false;
+
+        (*m_job)(*index);
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) m_remaining.notify_all();
+        return true;
+    }
+
+    void workerLoop(size_t self) {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+                if (m_quit) return;
+                seen = m_generation;
+            }
+
+            while (runOne(self)) {
+            }
+        }
+    }
+};
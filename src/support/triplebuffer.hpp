@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free mailbox between one producer and one consumer that only care about the latest value.
+// The producer fills writeBuffer() and publishes it, the consumer swaps in whatever was published last. Neither side ever waits,
+// values published while the consumer is busy simply replace each other.
+template <typename T>
+class TripleBuffer {
+  public:
+    TripleBuffer() = default;
+
+    // Disable copies
+    TripleBuffer(const TripleBuffer<T>&) = delete;
+    TripleBuffer& operator=(const TripleBuffer<T>&) = delete;
+
+    // Producer: the buffer to fill next, owned by the producer until publish()
+    T& writeBuffer() { return m_buffers[m_write]; }
+
+    // Producer: hands writeBuffer() to the consumer and takes the spare buffer in exchange
+    void publish() { m_write = m_middle.exchange(m_write | FRESH, std::memory_order_acq_rel) & INDEX_MASK; }
+
+    // Consumer: swaps in the latest published buffer if there is one, returns false when nothing new arrived
+    bool consume() {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        m_read = m_middle.exchange(m_read, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    // Consumer: the buffer last swapped in by consume(), owned by the consumer until the next successful consume()
+    T& readBuffer() { return m_buffers[m_read]; }
+
+    // Only safe while neither side is running
+    std::array<T, 3>& buffers() { return m_buffers; }
+
+  private:
+    static constexpr uint8_t INDEX_MASK = 3;
+    static constexpr uint8_t FRESH = 4;  // Set while the middle buffer holds a value the consumer has not seen
+
+    std::array<T, 3> m_buffers{};
+    uint8_t m_write = 0;
+    uint8_t m_read = 1;
+    alignas(64) std::atomic<uint8_t> m_middle = 2;
+};
@@ -1,15 +1,31 @@
 #include "timers.hpp"
 
+#include "gpu/gpu.hpp"
 #include "scheduler/scheduler.hpp"
 
 namespace Timers {
 
-Timers::Timers(Scheduler::Scheduler& scheduler) : scheduler(scheduler) { reset(); }
+Timers::Timers(Scheduler::Scheduler& scheduler) : scheduler(scheduler) {
+    using enum Scheduler::Event;
+    scheduler.registerEvent(Timer0, [this]() { irqEvent(0); });
+    scheduler.registerEvent(Timer1, [this]() { irqEvent(1); });
+    scheduler.registerEvent(Timer2, [this]() { irqEvent(2); });
+    reset();
+}
 
-void Timers::reset() { std::memset(timers, 0, sizeof(timers)); }
+void Timers::reset() {
+    for (u32 i = 0; i < 3; i++) {
+        cancelIRQ(timers[i]);
+        timers[i] = {};
+        timers[i].irq = true;
+        timers[i].lastSync = scheduler.cycles();
+        updateRate(i);
+    }
+}
 
 u16 Timers::read(u32 offset) {
     auto& timer = timers[offset >> 4];
+    sync(timer);
 
     switch (offset & 0xF) {
         case 0: return timer.counter;
@@ -38,17 +54,19 @@ u16 Timers::read(u32 offset) {
 }
 
 void Timers::write(u32 offset, u16 value) {
-    auto& timer = timers[offset >> 4];
+    const auto index = offset >> 4;
+    auto& timer = timers[index];
+    sync(timer);
+    cancelIRQ(timer);
 
     switch (offset & 0xF) {
         case 0:
             timer.counter = value;
             timer.atMax = false;
             timer.atTarget = false;
-            timer.irq = false;
             break;
         case 4: {
-            timer.syncEnable = Helpers::isBitSet(value, 1);
+            timer.syncEnable = Helpers::isBitSet(value, 0);
             timer.syncMode = (value >> 1) & 3;
             timer.targetWrap = Helpers::isBitSet(value, 3);
             timer.irqTarget = Helpers::isBitSet(value, 4);
@@ -57,19 +75,123 @@ void Timers::write(u32 offset, u16 value) {
             timer.irqPulse = Helpers::isBitSet(value, 7);
             timer.clockSource = (value >> 8) & 3;
             timer.irq = true;  // Set to 1 after writing mode
+            timer.irqDone = false;
             timer.counter = 0;
+            timer.fraction = 0;
+            updateRate(index);
             break;
         }
         case 8:
             timer.target = value;
             timer.atMax = false;
             timer.atTarget = false;
-            timer.irq = false;
             timer.counter = 0;  // Reset timer value
             break;
     }
+
+    scheduleIRQ(index);
+}
+
+void Timers::updateRate(u32 index) {
+    auto& timer = timers[index];
+    timer.rateNum = 1;
+    timer.rateDen = 1;
+
+    // Blanking based sync modes of timer 0/1 are not modelled, those timers free run
+    timer.paused = index == 2 && timer.syncEnable && (timer.syncMode == 0 || timer.syncMode == 3);
+
+    // Video clocks assume NTSC timing, the dotclock uses the 320 pixel wide divider
+    switch (index) {
+        case 0:
+            if (timer.clockSource & 1) {
+                timer.rateNum = GPU::GPU::GPU_CLOCK_NUM;
+                timer.rateDen = GPU::GPU::GPU_CLOCK_DEN * 8;
+            }
+            break;
+        case 1:
+            if (timer.clockSource & 1) {
+                timer.rateNum = GPU::GPU::GPU_CLOCK_NUM;
+                timer.rateDen = GPU::GPU::GPU_CLOCK_DEN * GPU::GPU::CYCLES_PER_SCANLINE_NTSC;
+            }
+            break;
+        case 2:
+            if (timer.clockSource & 2) timer.rateDen = 8;
+            break;
+    }
 }
 
-void Timers::update() { auto& timer = timers[2]; }
+void Timers::sync(Timer& timer) {
+    const auto now = scheduler.cycles();
+    const auto delta = now - timer.lastSync;
+    timer.lastSync = now;
+    if (timer.paused || delta == 0) return;
+
+    const u64 total = delta * timer.rateNum + timer.fraction;
+    const u64 ticks = total / timer.rateDen;
+    timer.fraction = static_cast<u32>(total % timer.rateDen);
+    if (ticks == 0) return;
+
+    if (ticksUntil(timer, timer.target) <= ticks) timer.atTarget = true;
+    if (ticksUntil(timer, 0xFFFF) <= ticks) timer.atMax = true;
+
+    // The current lap runs to the target or to 0xFFFF, every following lap restarts from 0
+    const u32 wrap = timer.targetWrap && timer.counter <= timer.target ? timer.target : 0xFFFF;
+    const u32 toZero = wrap - timer.counter + 1;
+    if (ticks < toZero) {
+        timer.counter += static_cast<u16>(ticks);
+    } else {
+        const u32 period = timer.targetWrap ? timer.target + 1 : 0x10000;
+        timer.counter = static_cast<u16>((ticks - toZero) % period);
+    }
+}
+
+// Ticks until the counter next holds value, NEVER if it can't get there
+u32 Timers::ticksUntil(const Timer& timer, u32 value) {
+    const u32 wrap = timer.targetWrap && timer.counter <= timer.target ? timer.target : 0xFFFF;
+    if (value > timer.counter && value <= wrap) return value - timer.counter;
+
+    const u32 lapWrap = timer.targetWrap ? timer.target : 0xFFFF;
+    if (value > lapWrap) return NEVER;
+    return wrap - timer.counter + 1 + value;
+}
+
+void Timers::scheduleIRQ(u32 index) {
+    auto& timer = timers[index];
+    if (timer.paused || (timer.irqDone && !timer.irqRepeat)) return;
+
+    u32 ticks = NEVER;
+    if (timer.irqTarget) ticks = std::min(ticks, ticksUntil(timer, timer.target));
+    if (timer.irqMax) ticks = std::min(ticks, ticksUntil(timer, 0xFFFF));
+    if (ticks == NEVER) return;
+
+    // Smallest cycle count after which the tick counter in sync() reaches the IRQ
+    const u64 needed = u64(ticks) * timer.rateDen - timer.fraction;
+    const u64 cycles = (needed + timer.rateNum - 1) / timer.rateNum;
+    timer.irqEvent = scheduler.scheduleAt(static_cast<Scheduler::Event>(static_cast<u32>(Scheduler::Event::Timer0) + index), timer.lastSync + cycles);
+}
+
+void Timers::cancelIRQ(Timer& timer) { scheduler.cancel(timer.irqEvent); }
+
+void Timers::irqEvent(u32 index) {
+    auto& timer = timers[index];
+    sync(timer);
+
+    if (timer.irqPulse) {
+        // Toggle mode, only the 1 -> 0 edge requests an interrupt
+        timer.irq = !timer.irq;
+    } else {
+        timer.irq = false;
+    }
+
+    if (!timer.irq) {
+        scheduler.bus.triggerInterrupt(static_cast<Bus::IRQ>(Bus::IRQ::TIMER0 + index));
+        timer.irqDone = true;
+    }
+
+    // Short pulse mode drops bit 10 for a few cycles only
+    if (!timer.irqPulse) timer.irq = true;
+
+    scheduleIRQ(index);
+}
 
 }  // namespace Timers
@@ -1,10 +1,7 @@
 #pragma once
+#include "scheduler/scheduler.hpp"
 #include "support/helpers.hpp"
 
-namespace Scheduler {
-class Scheduler;
-}
-
 namespace Timers {
 
 struct Timer {
@@ -24,6 +21,16 @@ struct Timer {
     bool atMax;
 
     bool paused;
+    bool irqDone;  // One-shot mode already fired since the last mode write
+
+    // The counter is only brought up to date when it is observed, ticks = (cycles * rateNum + fraction) / rateDen
+    Scheduler::Cycles lastSync;
+    u32 fraction;
+    u32 rateNum;
+    u32 rateDen;
+
+    // Pending target/overflow IRQ, withdrawn whenever a register write invalidates it
+    Scheduler::EventHandle irqEvent;
 };
 
 class Timers {
@@ -35,9 +42,17 @@ class Timers {
     u16 read(u32 offset);
     void write(u32 offset, u16 value);
 
-    void update();
-
   private:
+    static constexpr u32 NEVER = 0xFFFFFFFF;
+
+    void sync(Timer& timer);
+    void updateRate(u32 index);
+    void scheduleIRQ(u32 index);
+    void cancelIRQ(Timer& timer);
+    void irqEvent(u32 index);
+
+    static u32 ticksUntil(const Timer& timer, u32 value);
+
     Timer timers[3];
     Scheduler::Scheduler& scheduler;
 };